@@ -20,34 +20,21 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 */
 #include <libopencm3/stm32/gpio.h>
+#include <libopencm3/cm3/systick.h>
 
 
 #include <stdint.h>
-#include <string.h>
 #include "cmsis-dap.h"
 #include "swd.h"
+#include "swo.h"
 
-enum CMSIS_DAP_COMMAND
-{
-	ID_DAP_Info                     =	0x00,
-	ID_DAP_LED                      =	0x01,
-	ID_DAP_Connect                  =	0x02,
-	ID_DAP_Disconnect               =	0x03,
-	ID_DAP_TransferConfigure        =	0x04,
-	ID_DAP_Transfer                 =	0x05,
-	ID_DAP_TransferBlock            =	0x06,
-	ID_DAP_TransferAbort            =	0x07,
-	ID_DAP_WriteABORT               =	0x08,
-	ID_DAP_Delay                    =	0x09,
-	ID_DAP_ResetTarget              =	0x0A,
-	ID_DAP_SWJ_Pins                 =	0x10,
-	ID_DAP_SWJ_Clock                =	0x11,
-	ID_DAP_SWJ_Sequence             =	0x12,
-	ID_DAP_SWD_Configure            =	0x13,
-	ID_DAP_JTAG_Sequence            =	0x14,
-	ID_DAP_JTAG_Configure           =	0x15,
-	ID_DAP_JTAG_IDCODE              =	0x16,
-};
+/* the number of consecutive ap writes in a DAP_Transfer or DAP_TransferBlock
+ * request, after which the writes are checked for errors; ap writes are
+ * always checked at the end of a run of ap writes - zero means that
+ * they are only checked then */
+#ifndef CMSIS_DAP_WRITE_CHECK_INTERVAL
+#define CMSIS_DAP_WRITE_CHECK_INTERVAL	0
+#endif
 
 enum CMSIS_DAP_INFO_ID
 {
@@ -58,6 +45,7 @@ enum CMSIS_DAP_INFO_ID
 	DAP_INFO_TARGET_DEVICE_VENDOR		= 0x05, /* string */
 	DAP_INFO_TARGET_DEVICE_NAME		= 0x06, /* string */
 	DAP_INFO_CAPABILITIES			= 0xf0, /* byte */
+	DAP_INFO_SWO_BUFFER_SIZE		= 0xfd, /* word */
 	DAP_INFO_MAX_PACKET_COUNT		= 0xfe, /* byte */
 	DAP_INFO_MAX_PACKET_SIZE		= 0xff, /* short */
 };
@@ -74,8 +62,37 @@ enum
 	RUNNING_LED		= 1,
 	LED_OFF			= 0,
 	LED_ON			= 1,
+	/* the number of core clock cycles per microsecond */
+	CORE_CLOCKS_PER_US	= 72,
+	/* the target reset pulse width, and the time to wait
+	 * after releasing the target reset line, for ID_DAP_ResetTarget */
+	TARGET_RESET_ASSERT_US	= 10000,
+	TARGET_RESET_RECOVERY_US	= 10000,
+	/* the longest pin wait time allowed for ID_DAP_SWJ_Pins, in microseconds */
+	DAP_PIN_WAIT_TIME_MAX_US	= 3000000,
+};
+
+/* the DAP_INFO_CAPABILITIES bits */
+enum
+{
+	DAP_CAPABILITY_SWD		= 1 << 0,
+	DAP_CAPABILITY_SWO_UART		= 1 << 2,
+	DAP_CAPABILITY_SWO_STREAMING	= 1 << 6,
+};
+
+/* the pin bits for ID_DAP_SWJ_Pins; the pins not listed here
+ * (tdi, tdo, ntrst) are not available, and read back as zero */
+enum
+{
+	DAP_PIN_SWCLK	= 1 << 0,
+	DAP_PIN_SWDIO	= 1 << 1,
+	DAP_PIN_nRESET	= 1 << 7,
 };
 
+/* the target reset line */
+#define TARGET_NRESET_GPIO_BASE		GPIOB
+#define TARGET_NRESET_GPIO_MASK		GPIO6
+
 enum
 {
 	DAP_OK		= 0x00,
@@ -95,6 +112,18 @@ struct __attribute__((packed)) cmsis_dap_request
 		uint8_t		dap_port;
 		/* ID_DAP_SWJ_Clock request */
 		uint32_t	swj_clock;
+		/* ID_DAP_Delay request - delay in microseconds */
+		uint16_t	delay_us;
+		/* ID_DAP_SWO_Transport request - an enumerator from SWO_TRANSPORT_ENUM */
+		uint8_t		swo_transport;
+		/* ID_DAP_SWO_Mode request - an enumerator from SWO_MODE_ENUM */
+		uint8_t		swo_mode;
+		/* ID_DAP_SWO_Baudrate request */
+		uint32_t	swo_baudrate;
+		/* ID_DAP_SWO_Control request - nonzero to start capture, zero to stop it */
+		uint8_t		swo_control;
+		/* ID_DAP_SWO_Data request - the maximum number of trace bytes to return */
+		uint16_t	swo_max_count;
 		/* ID_DAP_TransferConfigure request */
 		struct __attribute__((packed))
 		{
@@ -136,6 +165,12 @@ struct __attribute__((packed)) cmsis_dap_request
 			uint8_t		block_transfer_request;
 			uint32_t	block_data[0];
 		};
+		/* ID_DAP_ExecuteCommands and ID_DAP_QueueCommands requests */
+		struct __attribute__((packed))
+		{
+			uint8_t		command_count;
+			uint8_t		commands[0];
+		};
 		/* ID_DAP_SWJ_Pins request */
 		struct __attribute__((packed))
 		{
@@ -188,16 +223,42 @@ struct __attribute__((packed)) cmsis_dap_response
 			{
 				uint8_t info_byte;
 				uint16_t info_short;
+				uint32_t info_word;
 				uint8_t	data[0];
 			};
 		};
 		/* ID_DAP_Connect response - port number */
 		uint8_t	dap_port;
+		/* ID_DAP_ResetTarget response */
+		struct __attribute__((packed))
+		{
+			/* same as 'status' */
+			uint8_t		reset_status;
+			/* nonzero if a reset sequence has been executed */
+			uint8_t		reset_execute;
+		};
 		/* ID_DAP_SWJ_Pins response */
 		struct __attribute__((packed))
 		{
 			uint8_t		pin_input;
 		};
+		/* ID_DAP_SWO_Baudrate response - the baudrate actually set */
+		uint32_t	swo_baudrate;
+		/* ID_DAP_SWO_Status response */
+		struct __attribute__((packed))
+		{
+			/* a combination of SWO_STATUS_ENUM bits */
+			uint8_t		swo_status;
+			uint32_t	swo_count;
+		};
+		/* ID_DAP_SWO_Data response */
+		struct __attribute__((packed))
+		{
+			/* a combination of SWO_STATUS_ENUM bits */
+			uint8_t		swo_data_status;
+			uint16_t	swo_data_count;
+			uint8_t		swo_data[0];
+		};
 		/* ID_DAP_Transfer response */
 		struct __attribute__((packed))
 		{
@@ -212,10 +273,25 @@ struct __attribute__((packed)) cmsis_dap_response
 			uint8_t		block_transfer_response;
 			uint32_t	block_transfer_data[0];
 		};
+		/* ID_DAP_ExecuteCommands response */
+		struct __attribute__((packed))
+		{
+			uint8_t		command_count;
+			uint8_t		responses[0];
+		};
 	};
 };
 
 int dap_xfer_req_cnt = 10;
+/* the number of times to retry a register read with value match, as set by ID_DAP_TransferConfigure */
+static int match_retry_count;
+/* the packet size of the interface on which the request being executed has been received */
+static int packet_size;
+/* the number of request bytes available to the command being executed (from
+ * the start of the command up to the end of the request packet), and the
+ * number of response bytes available for its response; commands with
+ * variable length requests and responses must not run past these */
+static int request_space, response_space;
 int dap_xfer_err_cnt;
 int block_cnt;
 
@@ -224,241 +300,931 @@ void report_error(void)
 	dap_xfer_err_cnt ++;
 }
 
-bool cmsis_dap_process_request(void * request, void * response)
+/* the data words in ID_DAP_Transfer requests and responses are, in general,
+ * not word aligned; the cortex-m3 core supports unaligned word accesses, so
+ * these are accessed through this packed structure, which makes the compiler
+ * generate single word loads and stores, instead of moving the bytes one by one */
+struct __attribute__((packed)) unaligned_word
 {
-uint32_t fetch_data(uint8_t * p) { return * p | (p[1] << 8) | (p[2] << 16) | (p[3] << 24); }
-void store_data(uint8_t * p, uint32_t data) { p[0] = data, p[1] = data >> 8, p[2] = data >> 16, p[3] = data >> 24; }
-struct cmsis_dap_request * req = (struct cmsis_dap_request *) request;
-struct cmsis_dap_response * res = (struct cmsis_dap_response *) response;
-bool status = false;
+	uint32_t	w;
+};
 
-	memset(res, 0, 64);
-	res->command_id = req->command_id;
-	if (req->block_transfer_count == 14)
-		report_error();
-	switch (req->command_id)
+static inline uint32_t fetch_data(uint8_t * p) { return ((struct unaligned_word *) p)->w; }
+static inline void store_data(uint8_t * p, uint32_t data) { ((struct unaligned_word *) p)->w = data; }
+
+/*!
+ *	\fn	static uint32_t dap_cycles_elapsed(uint32_t * last)
+ *	\brief	returns the number of core clock cycles elapsed since a previous systick counter reading
+ *
+ *	time is measured with the free running systick counter, which
+ *	is started in main(); it counts down at the core clock rate, and
+ *	wraps around every 2^24 core clock cycles, so this must be called
+ *	more often than that
+ *
+ *	\param	last	a pointer to the previous systick counter reading;
+ *			this is updated with the current reading
+ *	\return	the number of core clock cycles elapsed */
+static uint32_t dap_cycles_elapsed(uint32_t * last)
+{
+uint32_t now = systick_get_value(), elapsed = (* last - now) & 0xffffff;
+
+	* last = now;
+	return elapsed;
+}
+
+/*!
+ *	\fn	static void dap_delay_us(uint32_t us)
+ *	\brief	busy waits for the specified number of microseconds
+ *
+ *	\param	us	the number of microseconds to wait */
+static void dap_delay_us(uint32_t us)
+{
+uint32_t cycles = us * CORE_CLOCKS_PER_US, last = systick_get_value(), elapsed;
+
+	while ((elapsed = dap_cycles_elapsed(& last)) < cycles)
+		cycles -= elapsed;
+}
+
+/*!
+ *	\fn	static void dap_drive_nreset(bool level)
+ *	\brief	drives the target reset line
+ *
+ *	the reset line is driven open drain, as it is usually pulled up on
+ *	the target - so releasing it does not force it high, and the target
+ *	may keep holding it low
+ *
+ *	\param	level	false to assert the target reset, true to release it */
+static void dap_drive_nreset(bool level)
+{
+	if (level)
+		gpio_set(TARGET_NRESET_GPIO_BASE, TARGET_NRESET_GPIO_MASK);
+	else
+		gpio_clear(TARGET_NRESET_GPIO_BASE, TARGET_NRESET_GPIO_MASK);
+	gpio_set_mode(TARGET_NRESET_GPIO_BASE, GPIO_MODE_OUTPUT_2_MHZ,
+		      GPIO_CNF_OUTPUT_OPENDRAIN, TARGET_NRESET_GPIO_MASK);
+}
+
+/*!
+ *	\fn	static int dap_read_pins(void)
+ *	\brief	reads the levels of the swj pins
+ *
+ *	\return	the pin levels, in the ID_DAP_SWJ_Pins pin bit layout */
+static int dap_read_pins(void)
+{
+int pins = 0, sw_pins = sw_get_pins();
+
+	if (sw_pins & SW_PIN_SWCLK)
+		pins |= DAP_PIN_SWCLK;
+	if (sw_pins & SW_PIN_SWDIO)
+		pins |= DAP_PIN_SWDIO;
+	if (gpio_get(TARGET_NRESET_GPIO_BASE, TARGET_NRESET_GPIO_MASK))
+		pins |= DAP_PIN_nRESET;
+	return pins;
+}
+
+/* the command handlers below are invoked through the
+ * 'cmsis_dap_commands' table - see cmsis_dap_execute_command()
+ * for a description of their parameters and return value */
+
+static int dap_info(struct cmsis_dap_request * req, struct cmsis_dap_response * res, int * request_length)
+{
+	* request_length = 2;
+	switch (req->info_id)
 	{
-		case ID_DAP_Info:
-			switch (req->info_id)
-			{
-				case DAP_INFO_PRODUCT_ID:
-				case DAP_INFO_SERIAL_NUMBER:
-				case DAP_INFO_CMSIS_DAP_FIRMWARE_VERSION:
-				case DAP_INFO_VENDOR_ID:
-					res->info_len = 0;
-					status = true;
-					break;
-				case DAP_INFO_MAX_PACKET_SIZE:
-					res->info_len = 2;
-					res->info_short = 64;
-					status = true;
-					break;
-				case DAP_INFO_MAX_PACKET_COUNT:
-					res->info_len = 1;
-					res->info_short = 1;
-					status = true;
-					break;
-			}
+		case DAP_INFO_PRODUCT_ID:
+		case DAP_INFO_SERIAL_NUMBER:
+		case DAP_INFO_CMSIS_DAP_FIRMWARE_VERSION:
+		case DAP_INFO_VENDOR_ID:
+			res->info_len = 0;
 			break;
-		case ID_DAP_Connect:
-			switch (req->dap_port)
-			{
-				case DAP_PORT_SWD:
-					init_sw_hardware();
-					res->dap_port = DAP_PORT_SWD;
-					status = true;
-					break;
-			}
+		case DAP_INFO_MAX_PACKET_SIZE:
+			res->info_len = 2;
+			res->info_short = packet_size;
 			break;
-		case ID_DAP_SWJ_Clock:
-			/* ignored for now */
-			res->status = DAP_OK;
-			status = true;
+		case DAP_INFO_MAX_PACKET_COUNT:
+			res->info_len = 1;
+			res->info_byte = CMSIS_DAP_PACKET_COUNT;
 			break;
-		case ID_DAP_TransferConfigure:
-			/* ignored for now */
-			res->status = DAP_OK;
-			status = true;
+		case DAP_INFO_CAPABILITIES:
+			res->info_len = 1;
+			res->info_byte = DAP_CAPABILITY_SWD | DAP_CAPABILITY_SWO_UART | DAP_CAPABILITY_SWO_STREAMING;
 			break;
-		case ID_DAP_SWD_Configure:
-			/* ignored for now */
-			res->status = DAP_OK;
-			status = true;
+		case DAP_INFO_SWO_BUFFER_SIZE:
+			res->info_len = 4;
+			res->info_word = SWO_BUFFER_SIZE;
 			break;
-		case ID_DAP_LED:
-			/* ignored for now */
-			res->status = DAP_OK;
-			status = true;
+		default:
+			res->info_len = 0;
 			break;
-		case ID_DAP_SWJ_Sequence:
-			/* ignored for now */
-			res->status = DAP_OK;
-			status = true;
+	}
+	return 2 + res->info_len;
+}
+
+static int dap_connect(struct cmsis_dap_request * req, struct cmsis_dap_response * res, int * request_length)
+{
+	* request_length = 2;
+	switch (req->dap_port)
+	{
+		case DAP_PORT_SWD:
+			init_sw_hardware();
+			res->dap_port = DAP_PORT_SWD;
 			break;
-		case ID_DAP_Disconnect:
-			/* ignored for now */
-			res->status = DAP_OK;
-			status = true;
+		default:
+			/* connection failed */
+			res->dap_port = DAP_PORT_DEFAULT;
 			break;
-		case ID_DAP_WriteABORT:
-			/*! \todo	make use of the abort register symbollic address for better maintainability */
-			write_dp(0, req->abort_value);
-			res->status = DAP_OK;
-			status = true;
+	}
+	return 2;
+}
+
+static int dap_swj_clock(struct cmsis_dap_request * req, struct cmsis_dap_response * res, int * request_length)
+{
+	* request_length = 5;
+	if (req->swj_clock)
+	{
+		sw_set_clock(req->swj_clock);
+		res->status = DAP_OK;
+	}
+	else
+		res->status = DAP_ERROR;
+	return 2;
+}
+
+static int dap_transfer_abort(struct cmsis_dap_request * req, struct cmsis_dap_response * res, int * request_length)
+{
+	/* transfer abort requests are normally acted upon as soon as
+	 * they are received (see 'sw_transfer_abort'); one that ends up
+	 * here (e.g. in a command batch) has no transfer in progress
+	 * to abort, and has no response */
+	* request_length = 1;
+	return 0;
+}
+
+static int dap_transfer_configure(struct cmsis_dap_request * req, struct cmsis_dap_response * res, int * request_length)
+{
+	* request_length = 6;
+	sw_configure_transfers(req->idle_cycles, req->wait_retry_count);
+	match_retry_count = req->match_retry_count;
+	res->status = DAP_OK;
+	return 2;
+}
+
+static int dap_swd_configure(struct cmsis_dap_request * req, struct cmsis_dap_response * res, int * request_length)
+{
+	* request_length = 2;
+	/* ignored for now */
+	res->status = DAP_OK;
+	return 2;
+}
+
+static int dap_led(struct cmsis_dap_request * req, struct cmsis_dap_response * res, int * request_length)
+{
+	* request_length = 3;
+	/* ignored for now */
+	res->status = DAP_OK;
+	return 2;
+}
+
+static int dap_swj_sequence(struct cmsis_dap_request * req, struct cmsis_dap_response * res, int * request_length)
+{
+/* a bit count of 0 means 256 bits */
+int bit_count = req->sequence_bit_count ? req->sequence_bit_count : 256;
+
+	* request_length = 2 + (bit_count + 7) / 8;
+	if (* request_length > request_space)
+	{
+		/* the sequence is truncated - do not clock it out */
+		* request_length = request_space;
+		res->status = DAP_ERROR;
+		return 2;
+	}
+	sw_swj_sequence(req->sequence_bytes, bit_count);
+	res->status = DAP_OK;
+	return 2;
+}
+
+static int dap_disconnect(struct cmsis_dap_request * req, struct cmsis_dap_response * res, int * request_length)
+{
+	* request_length = 1;
+	/* ignored for now */
+	res->status = DAP_OK;
+	return 2;
+}
+
+static int dap_write_abort(struct cmsis_dap_request * req, struct cmsis_dap_response * res, int * request_length)
+{
+	* request_length = 6;
+	/*! \todo	make use of the abort register symbollic address for better maintainability */
+	write_dp(0, req->abort_value);
+	res->status = DAP_OK;
+	return 2;
+}
+
+static int dap_delay(struct cmsis_dap_request * req, struct cmsis_dap_response * res, int * request_length)
+{
+	* request_length = 3;
+	dap_delay_us(req->delay_us);
+	res->status = DAP_OK;
+	return 2;
+}
+
+static int dap_reset_target(struct cmsis_dap_request * req, struct cmsis_dap_response * res, int * request_length)
+{
+	* request_length = 1;
+	/* there is no device specific reset sequence - pulse the target
+	 * reset line instead */
+	dap_drive_nreset(false);
+	dap_delay_us(TARGET_RESET_ASSERT_US);
+	dap_drive_nreset(true);
+	dap_delay_us(TARGET_RESET_RECOVERY_US);
+	res->status = DAP_OK;
+	res->reset_execute = 1;
+	return 3;
+}
+
+/*!
+ *	\fn	static int dap_swj_pins(struct cmsis_dap_request * req, struct cmsis_dap_response * res, int * request_length)
+ *	\brief	handles the ID_DAP_SWJ_Pins command
+ *
+ *	the selected pins are driven to the requested levels, then the pins
+ *	are read back until the selected pins reach the requested levels, or
+ *	until the pin wait time elapses - e.g., a target may hold its reset
+ *	line low for a while after the probe has released it; the pins are
+ *	read back once, without waiting, if the pin wait time is zero */
+static int dap_swj_pins(struct cmsis_dap_request * req, struct cmsis_dap_response * res, int * request_length)
+{
+int select = req->pin_select, output = req->pin_output & select, pins;
+uint32_t wait_time = req->pin_wait_time, cycles, elapsed, last;
+
+	* request_length = 7;
+	sw_set_pins(((output & DAP_PIN_SWCLK) ? SW_PIN_SWCLK : 0) | ((output & DAP_PIN_SWDIO) ? SW_PIN_SWDIO : 0),
+			((select & DAP_PIN_SWCLK) ? SW_PIN_SWCLK : 0) | ((select & DAP_PIN_SWDIO) ? SW_PIN_SWDIO : 0));
+	if (select & DAP_PIN_nRESET)
+		dap_drive_nreset(output & DAP_PIN_nRESET);
+
+	if (wait_time > DAP_PIN_WAIT_TIME_MAX_US)
+		wait_time = DAP_PIN_WAIT_TIME_MAX_US;
+	cycles = wait_time * CORE_CLOCKS_PER_US;
+	last = systick_get_value();
+	while (((pins = dap_read_pins()) & select) != output && cycles)
+	{
+		elapsed = dap_cycles_elapsed(& last);
+		cycles = (elapsed < cycles) ? cycles - elapsed : 0;
+	}
+	res->pin_input = pins;
+	return 2;
+}
+
+
+/*!
+ *	\fn	static int dap_transfer(struct cmsis_dap_request * req, struct cmsis_dap_response * res, int * request_length)
+ *	\brief	handles ID_DAP_Transfer requests */
+static int dap_transfer(struct cmsis_dap_request * req, struct cmsis_dap_response * res, int * request_length)
+{
+static uint32_t match_mask;
+uint8_t * data_in = req->transfer_data, * data_out = res->transfer_data, swq;
+uint8_t * request_end = (uint8_t *) req + request_space, * response_end = (uint8_t *) res + response_space;
+/* if non-null, an ap read has been posted, and its result
+ * must be stored at this location when it is retrieved */
+uint8_t * posted_data_out = 0;
+/* the number of ap writes not yet checked for errors */
+int unchecked_writes = 0;
+uint32_t x;
+int transfer_count = req->transfer_count;
+
+	dap_xfer_req_cnt ++;
+	res->transfer_count = 0;
+	res->transfer_response = SW_ACK_OK;
+	while (transfer_count > 0 && !sw_transfer_abort)
+	{
+		/* transfers that do not fit in the request or in the response
+		 * packet are not executed; writes, and reads with value match,
+		 * carry a data word in the request, and the other reads return
+		 * a data word in the response */
+		if (data_in == request_end
+				|| ((!(* data_in & (1 << 1)) || (* data_in & (1 << 4))) && request_end - data_in < 1 + (int) sizeof(uint32_t))
+				|| ((* data_in & ((1 << 4) | (1 << 1))) == (1 << 1) && response_end - data_out < (int) sizeof(uint32_t)))
 			break;
-		case ID_DAP_SWJ_Pins:
-			/* only control the reset signal for now */
-			if (req->pin_select & (1 << 7))
+		transfer_count --;
+		swq = * data_in ++;
+		/* check the ap writes issued so far for errors, before
+		 * performing any transfer other than an ap write, and
+		 * after every CMSIS_DAP_WRITE_CHECK_INTERVAL ap writes */
+		if (unchecked_writes && ((swq & ((1 << 5) | (1 << 1) | (1 << 0))) != (1 << 0)
+					|| unchecked_writes == CMSIS_DAP_WRITE_CHECK_INTERVAL))
+		{
+			res->transfer_response = check_posted_writes();
+			if (res->transfer_response != SW_ACK_OK)
 			{
-				(req->pin_output & (1 << 7)) ? gpio_set(GPIOB, GPIO6) : gpio_clear(GPIOB, GPIO6);
-				if (req->pin_output & (1 << 7))
-				{
-					volatile int i;
-					for (i = 0; i < 1000; i++);
-					init_sw_hardware();
-					/* set boot block mapping on lpc1754 */
-					write_ap(1, 0x400fc040);
-					write_ap(3, 1);
-				}
+				/* the current transfer has not been executed */
+				data_in --;
+				transfer_count ++;
+				goto report_error;
 			}
-			res->pin_input = req->pin_output;
-			status = true;
-			break;
-		case ID_DAP_Transfer:
-			dap_xfer_req_cnt ++;
-			if (1)
+			res->transfer_count += unchecked_writes;
+			unchecked_writes = 0;
+		}
+		if ((swq & ((1 << 4) | (1 << 1) | (1 << 0))) == ((1 << 1) | (1 << 0)))
+		{
+			/* ap read, without value match - ap reads are posted, and
+			 * consecutive ap reads are pipelined: the data returned
+			 * here is the result of the previous ap read, if any */
+			res->transfer_response = sw_transfer(swq, & x);
+			if (res->transfer_response != SW_ACK_OK)
+				goto report_error;
+			if (posted_data_out)
 			{
-				static uint32_t match_mask;
-				uint8_t * data_in = req->transfer_data, * data_out = res->transfer_data, swq;
-				uint32_t x;
-				res->transfer_count = 0;
-				res->transfer_response = SW_ACK_OK;
-				while (req->transfer_count --)
+				store_data(posted_data_out, x);
+				res->transfer_count ++;
+			}
+			posted_data_out = data_out;
+			data_out += sizeof(uint32_t);
+			continue;
+		}
+		/* retrieve the result of a pending posted ap read, if any,
+		 * before performing any other transfer */
+		if (posted_data_out)
+		{
+			res->transfer_response = read_ap_posted_result(& x);
+			if (res->transfer_response != SW_ACK_OK)
+			{
+				/* the current transfer has not been executed */
+				data_in --;
+				transfer_count ++;
+				goto report_error;
+			}
+			store_data(posted_data_out, x);
+			res->transfer_count ++;
+			posted_data_out = 0;
+		}
+		if (swq & (1 << 1))
+		{
+			/* read access */
+			if (swq & (1 << 4))
+			{
+				uint32_t match_value = fetch_data(data_in);
+				int match_retries = match_retry_count;
+				data_in += sizeof(uint32_t);
+				/* read register with value match */
+				while (1)
 				{
-					swq = * data_in ++;
-					if (swq & (1 << 1))
+					res->transfer_response = ((swq & (1 << 0)) ? read_ap : read_dp)((swq >> 2) & 3, & x);
+					if (res->transfer_response != SW_ACK_OK)
+						goto report_error;
+					if ((x & match_mask) == match_value)
+						break;
+					if (match_retries -- <= 0)
 					{
-						/* read access */
-						if (swq & (1 << 4))
-						{
-							uint32_t match_value = fetch_data(data_in);
-							data_in += sizeof(uint32_t);
-							/* read register with value match */
-							while (1)
-							{
-								res->transfer_response = ((swq & (1 << 0)) ? read_ap : read_dp)((swq >> 2) & 3, & x);
-								if (res->transfer_response != SW_ACK_OK)
-									goto report_error;
-								if ((x & match_mask) == match_value)
-									break;
-							}
-res->transfer_count ++;
-							continue;
-						}
-						res->transfer_response = ((swq & (1 << 0)) ? read_ap : read_dp)((swq >> 2) & 3, & x);
-						store_data(data_out, x);
-						data_out += sizeof(uint32_t);
-						if (res->transfer_response != SW_ACK_OK)
-						{
-report_error:
-							report_error();
-							if (res->transfer_response == SW_ACK_PROTOCOL_ERROR)
-							{
-								res->transfer_response = SW_ACK_FAULT;
-								res->transfer_response |= 1 << 3;
-							}
-							break;
-						}
+						/* report a value mismatch */
+						res->transfer_response |= 1 << 4;
+						goto report_error;
 					}
-					else
-					{
-						/* write access */
-						if (swq & (1 << 5))
-						{
-							/* write match mask */
-							match_mask = fetch_data(data_in);
-							data_in += sizeof(uint32_t);
-res->transfer_count ++;
-							continue;
-						}
-						/* normal write access */
-						x = fetch_data(data_in);
-						data_in += sizeof(uint32_t);
-						res->transfer_response = ((swq & (1 << 0)) ? write_ap : write_dp)((swq >> 2) & 3, x);
-						if (res->transfer_response != SW_ACK_OK)
-						{
-							report_error();
-							if (res->transfer_response == SW_ACK_PROTOCOL_ERROR)
-							{
-								res->transfer_response = SW_ACK_FAULT;
-								res->transfer_response |= 1 << 3;
-							}
-							break;
-						}
-					}
-					res->transfer_count ++;
+					if (sw_transfer_abort)
+						break;
 				}
-				if (res->transfer_response != SW_ACK_OK)
+				if ((x & match_mask) != match_value)
+					/* aborted */
+					break;
+res->transfer_count ++;
+				continue;
+			}
+			res->transfer_response = ((swq & (1 << 0)) ? read_ap : read_dp)((swq >> 2) & 3, & x);
+			if (res->transfer_response != SW_ACK_OK)
+			{
+report_error:
+				report_error();
+				if (res->transfer_response == SW_ACK_PROTOCOL_ERROR)
 				{
-					if (1) init_sw_hardware();
-					while(0);
+					res->transfer_response = SW_ACK_FAULT;
+					res->transfer_response |= 1 << 3;
 				}
-				status = true;
 				break;
 			}
-			status = true;
-			break;
-		case ID_DAP_TransferBlock:
+			store_data(data_out, x);
+			data_out += sizeof(uint32_t);
+		}
+		else
+		{
+			/* write access */
+			if (swq & (1 << 5))
 			{
-				uint32_t x;
-				int idx = 0;
-				res->block_transfer_count = 0;
-				res->block_transfer_response = SW_ACK_OK;
-				while (req->block_transfer_count --)
+				/* write match mask */
+				match_mask = fetch_data(data_in);
+				data_in += sizeof(uint32_t);
+res->transfer_count ++;
+				continue;
+			}
+			/* normal write access */
+			x = fetch_data(data_in);
+			data_in += sizeof(uint32_t);
+			res->transfer_response = ((swq & (1 << 0)) ? write_ap_posted : write_dp)((swq >> 2) & 3, x);
+			if (res->transfer_response != SW_ACK_OK)
+			{
+				report_error();
+				if (res->transfer_response == SW_ACK_PROTOCOL_ERROR)
 				{
-					res->block_transfer_count ++;
-					if (req->block_transfer_request & (1 << 1))
-					{
-						/* read access */
-						res->block_transfer_response = ((req->block_transfer_request & (1 << 0)) ? read_ap : read_dp)((req->block_transfer_request >> 2) & 3, & x);
-						res->block_transfer_data[idx ++] = x;
-						if (res->block_transfer_response != SW_ACK_OK)
-						{
-							report_error();
-							if (res->block_transfer_response == SW_ACK_PROTOCOL_ERROR)
-							{
-								res->block_transfer_response = SW_ACK_FAULT;
-								res->block_transfer_response |= 1 << 3;
-							}
-							break;
-						}
-					}
-					else
-					{
-						/* write access */
-						res->block_transfer_response = ((req->block_transfer_request & (1 << 0)) ? write_ap : write_dp)((req->block_transfer_request >> 2) & 3, req->block_data[idx ++]);
-						if (res->block_transfer_response != SW_ACK_OK)
-						{
-							report_error();
-							if (res->block_transfer_response == SW_ACK_PROTOCOL_ERROR)
-							{
-								res->block_transfer_response = SW_ACK_FAULT;
-								res->block_transfer_response |= 1 << 3;
-							}
-							break;
-						}
-					}
+					res->transfer_response = SW_ACK_FAULT;
+					res->transfer_response |= 1 << 3;
 				}
+				break;
+			}
+			if (swq & (1 << 0))
+			{
+				/* ap writes are only counted once they
+				 * have been checked for errors */
+				unchecked_writes ++;
+				continue;
+			}
+		}
+		res->transfer_count ++;
+	}
+	if (res->transfer_response == SW_ACK_OK && unchecked_writes)
+	{
+		res->transfer_response = check_posted_writes();
+		if (res->transfer_response == SW_ACK_OK)
+			res->transfer_count += unchecked_writes;
+		else
+		{
+			report_error();
+			if (res->transfer_response == SW_ACK_PROTOCOL_ERROR)
+			{
+				res->transfer_response = SW_ACK_FAULT;
+				res->transfer_response |= 1 << 3;
+			}
+		}
+	}
+	if (res->transfer_response == SW_ACK_OK && posted_data_out)
+	{
+		/* retrieve the result of the last posted ap read */
+		res->transfer_response = read_ap_posted_result(& x);
+		if (res->transfer_response == SW_ACK_OK)
+		{
+			store_data(posted_data_out, x);
+			res->transfer_count ++;
+			posted_data_out = 0;
+		}
+		else
+		{
+			report_error();
+			if (res->transfer_response == SW_ACK_PROTOCOL_ERROR)
+			{
+				res->transfer_response = SW_ACK_FAULT;
+				res->transfer_response |= 1 << 3;
+			}
+		}
+	}
+	/* the result of a posted ap read that was not
+	 * retrieved is not reported */
+	if (res->transfer_response != SW_ACK_OK && posted_data_out)
+		data_out = posted_data_out;
+	/* skip the transfers that have not been executed (because of
+	 * an error, or an abort request), in order to determine the
+	 * length of the request */
+	while (transfer_count -- > 0 && data_in < request_end)
+	{
+		swq = * data_in ++;
+		if (!(swq & (1 << 1)) || (swq & (1 << 4)))
+			data_in += sizeof(uint32_t);
+	}
+	if (data_in > request_end)
+		data_in = request_end;
+	/* a value mismatch alone needs no recovery, as the mismatch
+	 * flag is reported along with an 'ok' acknowledge */
+	if (res->transfer_response != SW_ACK_OK)
+		sw_recover((res->transfer_response & (1 << 3)) ? SW_ACK_PROTOCOL_ERROR : res->transfer_response & 7);
+	sw_transfer_abort = false;
+	* request_length = data_in - (uint8_t *) req;
+	return data_out - (uint8_t *) res;
+}
+
+/*!
+ *	\fn	static int dap_transfer_block(struct cmsis_dap_request * req, struct cmsis_dap_response * res, int * request_length)
+ *	\brief	handles ID_DAP_TransferBlock requests */
+static int dap_transfer_block(struct cmsis_dap_request * req, struct cmsis_dap_response * res, int * request_length)
+{
+uint32_t x;
+int idx = 0;
+int transfer_count = req->block_transfer_count;
+
+	* request_length = 5;
+	if (!(req->block_transfer_request & (1 << 1)))
+	{
+		* request_length += transfer_count * sizeof(uint32_t);
+		/* the data words that do not fit in the request packet are not written */
+		if (* request_length > request_space)
+		{
+			* request_length = request_space;
+			transfer_count = (request_space - 5) / sizeof(uint32_t);
+		}
+	}
+	else if (transfer_count > (response_space - 4) / (int) sizeof(uint32_t))
+		/* the data words that do not fit in the response packet are not read */
+		transfer_count = (response_space - 4) / sizeof(uint32_t);
+	res->block_transfer_count = 0;
+	res->block_transfer_response = SW_ACK_OK;
+	if ((req->block_transfer_request & ((1 << 1) | (1 << 0))) == ((1 << 1) | (1 << 0)))
+	{
+		/* ap reads - these are posted, so they are pipelined: each ap
+		 * read returns the result of the previous one, and the result
+		 * of the last ap read is retrieved from the dp RDBUFF register */
+		if (transfer_count)
+			res->block_transfer_response = sw_transfer(req->block_transfer_request, & x);
+		while (res->block_transfer_response == SW_ACK_OK && !sw_transfer_abort && transfer_count --)
+		{
+			if (transfer_count)
+				res->block_transfer_response = sw_transfer(req->block_transfer_request, & x);
+			else
+				res->block_transfer_response = read_ap_posted_result(& x);
+			if (res->block_transfer_response == SW_ACK_OK)
+			{
+				res->block_transfer_data[idx ++] = x;
+				res->block_transfer_count ++;
+			}
+		}
+		if (res->block_transfer_response != SW_ACK_OK)
+		{
+			report_error();
+			if (res->block_transfer_response == SW_ACK_PROTOCOL_ERROR)
+			{
+				res->block_transfer_response = SW_ACK_FAULT;
+				res->block_transfer_response |= 1 << 3;
+			}
+		}
+	}
+	else if ((req->block_transfer_request & ((1 << 1) | (1 << 0))) == (1 << 0))
+	{
+		/* ap writes - these are streamed, and only checked for errors
+		 * after every CMSIS_DAP_WRITE_CHECK_INTERVAL writes, and at the
+		 * end of the block; writes are only counted once checked */
+		int unchecked_writes = 0;
+		while (!sw_transfer_abort && transfer_count --)
+		{
+			res->block_transfer_response = write_ap_posted((req->block_transfer_request >> 2) & 3, req->block_data[idx ++]);
+			if (res->block_transfer_response != SW_ACK_OK)
+				break;
+			if (++ unchecked_writes == CMSIS_DAP_WRITE_CHECK_INTERVAL || !transfer_count || sw_transfer_abort)
+			{
+				res->block_transfer_response = check_posted_writes();
 				if (res->block_transfer_response != SW_ACK_OK)
+					break;
+				res->block_transfer_count += unchecked_writes;
+				unchecked_writes = 0;
+			}
+		}
+		if (res->block_transfer_response != SW_ACK_OK)
+		{
+			report_error();
+			if (res->block_transfer_response == SW_ACK_PROTOCOL_ERROR)
+			{
+				res->block_transfer_response = SW_ACK_FAULT;
+				res->block_transfer_response |= 1 << 3;
+			}
+		}
+	}
+	else while (!sw_transfer_abort && transfer_count --)
+	{
+		if (req->block_transfer_request & (1 << 1))
+		{
+			/* read access */
+			res->block_transfer_response = ((req->block_transfer_request & (1 << 0)) ? read_ap : read_dp)((req->block_transfer_request >> 2) & 3, & x);
+			if (res->block_transfer_response != SW_ACK_OK)
+			{
+				report_error();
+				if (res->block_transfer_response == SW_ACK_PROTOCOL_ERROR)
 				{
-					if (1) init_sw_hardware();
-					while(0);
+					res->block_transfer_response = SW_ACK_FAULT;
+					res->block_transfer_response |= 1 << 3;
 				}
-				status = true;
 				break;
 			}
+			res->block_transfer_data[idx ++] = x;
+		}
+		else
+		{
+			/* write access */
+			res->block_transfer_response = ((req->block_transfer_request & (1 << 0)) ? write_ap : write_dp)((req->block_transfer_request >> 2) & 3, req->block_data[idx ++]);
+			if (res->block_transfer_response != SW_ACK_OK)
+			{
+				report_error();
+				if (res->block_transfer_response == SW_ACK_PROTOCOL_ERROR)
+				{
+					res->block_transfer_response = SW_ACK_FAULT;
+					res->block_transfer_response |= 1 << 3;
+				}
+				break;
+			}
+		}
+		res->block_transfer_count ++;
+	}
+	if (res->block_transfer_response != SW_ACK_OK)
+		sw_recover((res->block_transfer_response & (1 << 3)) ? SW_ACK_PROTOCOL_ERROR : res->block_transfer_response & 7);
+	sw_transfer_abort = false;
+	if (req->block_transfer_request & (1 << 1))
+		return 4 + idx * sizeof(uint32_t);
+	return 4;
+}
+
+static int dap_swo_transport(struct cmsis_dap_request * req, struct cmsis_dap_response * res, int * request_length)
+{
+	* request_length = 2;
+	res->status = swo_set_transport(req->swo_transport) ? DAP_OK : DAP_ERROR;
+	return 2;
+}
+
+static int dap_swo_mode(struct cmsis_dap_request * req, struct cmsis_dap_response * res, int * request_length)
+{
+	* request_length = 2;
+	res->status = swo_set_mode(req->swo_mode) ? DAP_OK : DAP_ERROR;
+	return 2;
+}
+
+static int dap_swo_baudrate(struct cmsis_dap_request * req, struct cmsis_dap_response * res, int * request_length)
+{
+	* request_length = 5;
+	res->swo_baudrate = swo_set_baudrate(req->swo_baudrate);
+	return 5;
+}
+
+static int dap_swo_control(struct cmsis_dap_request * req, struct cmsis_dap_response * res, int * request_length)
+{
+	* request_length = 2;
+	res->status = swo_control(req->swo_control) ? DAP_OK : DAP_ERROR;
+	return 2;
+}
+
+static int dap_swo_status(struct cmsis_dap_request * req, struct cmsis_dap_response * res, int * request_length)
+{
+	* request_length = 1;
+	res->swo_status = swo_get_status();
+	res->swo_count = swo_get_count();
+	return 6;
+}
+
+/*!
+ *	\fn	static int dap_swo_data(struct cmsis_dap_request * req, struct cmsis_dap_response * res, int * request_length)
+ *	\brief	handles the ID_DAP_SWO_Data command
+ *
+ *	the trace data is copied from the trace buffer straight into the
+ *	response; as much data as fits in the response space available is
+ *	returned - this is less than a full packet in command batches */
+static int dap_swo_data(struct cmsis_dap_request * req, struct cmsis_dap_response * res, int * request_length)
+{
+int count = req->swo_max_count;
+
+	* request_length = 3;
+	/* leave room for the command id, the status and the count fields */
+	if (count > response_space - 4)
+		count = response_space - 4;
+	count = swo_read(res->swo_data, count);
+	res->swo_data_status = swo_get_status();
+	res->swo_data_count = count;
+	return 4 + count;
+}
+
+/*!
+ *	\fn	static int dap_invalid(struct cmsis_dap_request * req, struct cmsis_dap_response * res, int * request_length)
+ *	\brief	handles unknown and unsupported commands
+ *
+ *	the response is a single ID_DAP_Invalid byte; the length of an unknown
+ *	command can not be determined, so a request length of zero is reported */
+static int dap_invalid(struct cmsis_dap_request * req, struct cmsis_dap_response * res, int * request_length)
+{
+	* request_length = 0;
+	res->command_id = ID_DAP_Invalid;
+	return 1;
+}
+
+/* a command handler, along with the lengths of the command request and
+ * of the longest command response; for commands with variable length
+ * requests or responses, these are the lengths of their fixed parts -
+ * the handlers of such commands limit themselves to the request and
+ * response space available, see 'request_space' and 'response_space' */
+struct cmsis_dap_command
+{
+	int	(* handler)(struct cmsis_dap_request * req, struct cmsis_dap_response * res, int * request_length);
+	uint8_t	request_length;
+	uint8_t	response_length;
+};
+
+/* the command handlers, indexed by command id; commands without a handler
+ * here (including the jtag commands) are handled by dap_invalid() */
+static const struct cmsis_dap_command cmsis_dap_commands[] =
+{
+	[ID_DAP_Info]			= { dap_info,			2, 6, },
+	[ID_DAP_LED]			= { dap_led,			3, 2, },
+	[ID_DAP_Connect]		= { dap_connect,		2, 2, },
+	[ID_DAP_Disconnect]		= { dap_disconnect,		1, 2, },
+	[ID_DAP_TransferConfigure]	= { dap_transfer_configure,	6, 2, },
+	[ID_DAP_Transfer]		= { dap_transfer,		3, 3, },
+	[ID_DAP_TransferBlock]		= { dap_transfer_block,		5, 4, },
+	[ID_DAP_TransferAbort]		= { dap_transfer_abort,		1, 0, },
+	[ID_DAP_WriteABORT]		= { dap_write_abort,		6, 2, },
+	[ID_DAP_Delay]			= { dap_delay,			3, 2, },
+	[ID_DAP_ResetTarget]		= { dap_reset_target,		1, 3, },
+	[ID_DAP_SWJ_Pins]		= { dap_swj_pins,		7, 2, },
+	[ID_DAP_SWJ_Clock]		= { dap_swj_clock,		5, 2, },
+	[ID_DAP_SWJ_Sequence]		= { dap_swj_sequence,		2, 2, },
+	[ID_DAP_SWD_Configure]		= { dap_swd_configure,		2, 2, },
+	[ID_DAP_SWO_Transport]		= { dap_swo_transport,		2, 2, },
+	[ID_DAP_SWO_Mode]		= { dap_swo_mode,		2, 2, },
+	[ID_DAP_SWO_Baudrate]		= { dap_swo_baudrate,		5, 5, },
+	[ID_DAP_SWO_Control]		= { dap_swo_control,		2, 2, },
+	[ID_DAP_SWO_Status]		= { dap_swo_status,		1, 6, },
+	[ID_DAP_SWO_Data]		= { dap_swo_data,		3, 4, },
+};
+
+static const struct cmsis_dap_command cmsis_dap_invalid_command = { dap_invalid, 1, 1, };
+
+/*!
+ *	\fn	static const struct cmsis_dap_command * cmsis_dap_find_command(uint8_t command_id)
+ *	\brief	looks up the handler of a command
+ *
+ *	\param	command_id	the command id
+ *	\return	the command handler entry; unknown commands are handled by dap_invalid() */
+static const struct cmsis_dap_command * cmsis_dap_find_command(uint8_t command_id)
+{
+	if (command_id < sizeof cmsis_dap_commands / sizeof * cmsis_dap_commands
+			&& cmsis_dap_commands[command_id].handler)
+		return & cmsis_dap_commands[command_id];
+	return & cmsis_dap_invalid_command;
+}
+
+/*!
+ *	\fn	static int cmsis_dap_execute_command(struct cmsis_dap_request * req, struct cmsis_dap_response * res, int * request_length)
+ *	\brief	executes a single cmsis-dap command
+ *
+ *	the command must fit in 'request_space', and its response must fit
+ *	in 'response_space' - see cmsis_dap_execute_commands()
+ *
+ *	\param	req	the command request
+ *	\param	res	the location at which to build the command response
+ *	\param	request_length	the location at which to store the number of request
+ *				bytes that the command occupies; this is needed for
+ *				locating the next command in ID_DAP_ExecuteCommands requests;
+ *				zero is stored here for unknown commands
+ *	\return	the number of response bytes produced by the command */
+static int cmsis_dap_execute_command(struct cmsis_dap_request * req, struct cmsis_dap_response * res, int * request_length)
+{
+	res->command_id = req->command_id;
+	if (req->block_transfer_count == 14)
+		report_error();
+	return cmsis_dap_find_command(req->command_id)->handler(req, res, request_length);
+}
+
+
+/*!
+ *	\fn	static int cmsis_dap_execute_commands(struct cmsis_dap_request * req, struct cmsis_dap_response * res)
+ *	\brief	executes the commands packed in an ID_DAP_ExecuteCommands (or ID_DAP_QueueCommands) request
+ *
+ *	the responses of the individual commands are concatenated in the
+ *	response, in the order in which the commands appear in the request;
+ *	nested command batches are not supported - command execution stops
+ *	at the first such nested batch command; command execution also stops
+ *	at the first command that runs past the end of the request packet,
+ *	or whose longest response does not fit in the rest of the response packet
+ *
+ *	\param	req	the batched commands request
+ *	\param	res	the location at which to build the response
+ *	\return	the number of response bytes produced */
+static int cmsis_dap_execute_commands(struct cmsis_dap_request * req, struct cmsis_dap_response * res)
+{
+uint8_t * command = req->commands, * response = res->responses;
+const struct cmsis_dap_command * entry;
+int i, request_length;
+
+	/* responses to queued commands are reported as responses to executed commands */
+	res->command_id = ID_DAP_ExecuteCommands;
+	res->command_count = 0;
+	for (i = 0; i < req->command_count; i ++)
+	{
+		if (* command == ID_DAP_ExecuteCommands || * command == ID_DAP_QueueCommands
+				|| command >= (uint8_t *) req + packet_size)
+			/* nested command batches are not supported */
+			break;
+		entry = cmsis_dap_find_command(* command);
+		request_space = (uint8_t *) req + packet_size - command;
+		response_space = (uint8_t *) res + packet_size - response;
+		if (request_space < entry->request_length || response_space < entry->response_length)
+			/* the command is truncated, or its response may not fit */
+			break;
+		response += cmsis_dap_execute_command((struct cmsis_dap_request *) command,
+				(struct cmsis_dap_response *) response, & request_length);
+		res->command_count ++;
+		if (!request_length)
+			/* unknown command - the commands following it can not be located */
+			break;
+		command += request_length;
+	}
+	return response - (uint8_t *) res;
+}
+
+/*!
+ *	\fn	static int cmsis_dap_command_length(const uint8_t * command, int length)
+ *	\brief	determines the length of a command from the part of it received so far
+ *
+ *	\param	command	the command
+ *	\param	length	the number of command bytes received so far
+ *	\return	the command length, or zero if it can not be determined from
+ *		the bytes received so far; unknown commands are one byte long */
+static int cmsis_dap_command_length(const uint8_t * command, int length)
+{
+int n, i;
+
+	switch (command[0])
+	{
+		case ID_DAP_Transfer:
+			if (length < 3)
+				return 0;
+			/* writes, and reads with value match, carry a data word */
+			for (n = 3, i = command[2]; i; i --)
+			{
+				if (n >= length)
+					return 0;
+				n += (!(command[n] & (1 << 1)) || (command[n] & (1 << 4))) ? 1 + sizeof(uint32_t) : 1;
+			}
+			break;
+		case ID_DAP_TransferBlock:
+			if (length < 5)
+				return 0;
+			n = 5;
+			if (!(command[4] & (1 << 1)))
+				n += (command[2] | command[3] << 8) * sizeof(uint32_t);
+			break;
+		case ID_DAP_SWJ_Sequence:
+			if (length < 2)
+				return 0;
+			n = 2 + ((command[1] ? command[1] : 256) + 7) / 8;
+			break;
 		default:
-			while (1);
+			n = cmsis_dap_find_command(command[0])->request_length;
+			break;
 	}
-	return status;
+	return n <= length ? n : 0;
+}
+
+/*!
+ *	\fn	int cmsis_dap_request_length(const void * request, int length)
+ *	\brief	determines the length of a request from the part of it received so far
+ *
+ *	this is used for locating the end of requests that are transferred as
+ *	several usb packets - so that the host does not have to end a request
+ *	that is a multiple of the usb packet size long with a zero length packet;
+ *	for command batches containing an unknown or a nested batch command, the
+ *	request is considered to end at that command, as command execution stops
+ *	there anyway
+ *
+ *	\param	request	the request
+ *	\param	length	the number of request bytes received so far
+ *	\return	the request length, or zero if it can not be determined from
+ *		the bytes received so far */
+int cmsis_dap_request_length(const void * request, int length)
+{
+const uint8_t * req = (const uint8_t *) request;
+int n, i, command_length;
+
+	if (req[0] != ID_DAP_ExecuteCommands && req[0] != ID_DAP_QueueCommands)
+		return cmsis_dap_command_length(req, length);
+	if (length < 2)
+		return 0;
+	for (n = 2, i = req[1]; i; i --)
+	{
+		if (n >= length)
+			return 0;
+		if (req[n] == ID_DAP_ExecuteCommands || req[n] == ID_DAP_QueueCommands
+				|| cmsis_dap_find_command(req[n])->handler == dap_invalid)
+			return n + 1;
+		if (!(command_length = cmsis_dap_command_length(req + n, length - n)))
+			return 0;
+		n += command_length;
+	}
+	return n;
+}
+
+/*!
+ *	\fn	int cmsis_dap_process_request(void * request, void * response, int interface_packet_size)
+ *	\brief	executes a cmsis-dap request packet
+ *
+ *	the response is built in place, in the packet buffer that is then
+ *	shipped to the host; only the response bytes produced by the executed
+ *	commands are written, the contents of the rest of the response packet
+ *	buffer are undefined
+ *
+ *	\param	request	the request packet
+ *	\param	response	the location at which to build the response packet;
+ *			this should be word aligned, so that the data words in
+ *			ID_DAP_TransferBlock responses are word aligned as well
+ *	\param	interface_packet_size	the cmsis-dap packet size of the interface on which
+ *			the request has been received
+ *	\return	the number of response bytes produced - this is the number
+ *		of bytes that must be shipped to the host */
+int cmsis_dap_process_request(void * request, void * response, int interface_packet_size)
+{
+struct cmsis_dap_request * req = (struct cmsis_dap_request *) request;
+struct cmsis_dap_response * res = (struct cmsis_dap_response *) response;
+int request_length;
+
+	packet_size = request_space = response_space = interface_packet_size;
+	if (req->command_id == ID_DAP_ExecuteCommands || req->command_id == ID_DAP_QueueCommands)
+		return cmsis_dap_execute_commands(req, res);
+	return cmsis_dap_execute_command(req, res, & request_length);
 }
@@ -21,4 +21,71 @@ THE SOFTWARE.
 */
 #include <stdbool.h>
 
-bool cmsis_dap_process_request(void * request, void * response);
+/* the number of cmsis-dap packets that the probe can buffer; this is
+ * reported to the host (in the DAP_INFO_MAX_PACKET_COUNT info response),
+ * so that the host can have up to this many requests in flight; each
+ * buffered packet costs a request and a response buffer of
+ * CMSIS_DAP_PACKET_SIZE bytes each, out of the 20 kbytes of ram on the
+ * stm32f103 - a depth of 8 takes 1 kbyte; this must be a power of two */
+#ifndef CMSIS_DAP_PACKET_COUNT
+#define CMSIS_DAP_PACKET_COUNT		4
+#endif
+
+#if (CMSIS_DAP_PACKET_COUNT < 1) || (CMSIS_DAP_PACKET_COUNT & (CMSIS_DAP_PACKET_COUNT - 1))
+#error "CMSIS_DAP_PACKET_COUNT must be a power of two"
+#endif
+
+/* the size of the cmsis-dap packets on the bulk interface, reported to the
+ * host in the DAP_INFO_MAX_PACKET_SIZE info response; packets larger than
+ * the 64 byte bulk endpoints are transferred as several usb packets, so
+ * that a single DAP_TransferBlock request can carry many more data words;
+ * this must be a multiple of 64 */
+#ifndef CMSIS_DAP_PACKET_SIZE
+#define CMSIS_DAP_PACKET_SIZE		64
+#endif
+
+#if (CMSIS_DAP_PACKET_SIZE < 64) || (CMSIS_DAP_PACKET_SIZE % 64)
+#error "CMSIS_DAP_PACKET_SIZE must be a multiple of 64"
+#endif
+
+enum
+{
+	/* the size of the cmsis-dap packets on the hid interface - these
+	 * always fit in a single usb packet */
+	CMSIS_DAP_HID_PACKET_SIZE	= 64,
+};
+
+enum CMSIS_DAP_COMMAND
+{
+	ID_DAP_Info                     =	0x00,
+	ID_DAP_LED                      =	0x01,
+	ID_DAP_Connect                  =	0x02,
+	ID_DAP_Disconnect               =	0x03,
+	ID_DAP_TransferConfigure        =	0x04,
+	ID_DAP_Transfer                 =	0x05,
+	ID_DAP_TransferBlock            =	0x06,
+	ID_DAP_TransferAbort            =	0x07,
+	ID_DAP_WriteABORT               =	0x08,
+	ID_DAP_Delay                    =	0x09,
+	ID_DAP_ResetTarget              =	0x0A,
+	ID_DAP_SWJ_Pins                 =	0x10,
+	ID_DAP_SWJ_Clock                =	0x11,
+	ID_DAP_SWJ_Sequence             =	0x12,
+	ID_DAP_SWD_Configure            =	0x13,
+	ID_DAP_JTAG_Sequence            =	0x14,
+	ID_DAP_JTAG_Configure           =	0x15,
+	ID_DAP_JTAG_IDCODE              =	0x16,
+	ID_DAP_SWO_Transport            =	0x17,
+	ID_DAP_SWO_Mode                 =	0x18,
+	ID_DAP_SWO_Baudrate             =	0x19,
+	ID_DAP_SWO_Control              =	0x1A,
+	ID_DAP_SWO_Status               =	0x1B,
+	ID_DAP_SWO_Data                 =	0x1C,
+	ID_DAP_QueueCommands            =	0x7E,
+	ID_DAP_ExecuteCommands          =	0x7F,
+	/* response command id for unknown and unsupported commands */
+	ID_DAP_Invalid                  =	0xFF,
+};
+
+int cmsis_dap_process_request(void * request, void * response, int packet_size);
+int cmsis_dap_request_length(const void * request, int length);
@@ -0,0 +1,625 @@
+/*
+Copyright (c) 2015-2016 stoyan shopov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* a benchmark harness for the cmsis-dap request processing code; the
+ * probe firmware sources (cmsis-dap.c, swd.c and swo.c) are built for the host,
+ * with the serial wire connected to the target model in swd-target.c,
+ * and are fed with the kind of request sequences a debugger issues when
+ * programming and verifying target memory; the serial wire traffic
+ * generated for each such sequence is reported, and the data read back
+ * from the target is verified; trace data is fed to the simulated swo
+ * receiver in swo-sim.c, and is read back with the DAP_SWO_* commands
+ *
+ * usage: dap-bench [-n word_count] [-w wait_interval] [-p parity_error_interval]
+ *	-n	the number of data words to write to, and read from the
+ *		target ram (default 4096)
+ *	-w	make the target acknowledge every 'wait_interval'-th ap
+ *		access with a 'wait' response (default 0 - never)
+ *	-p	make the target send a bad parity bit on every
+ *		'parity_error_interval'-th ap and dp RDBUFF read (default 0 - never)
+ *
+ * the exit status is zero if all the tests passed */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../cmsis-dap.h"
+#include "../swo.h"
+#include "swd-target.h"
+#include "swo-sim.h"
+
+enum
+{
+	/* mem-ap register addresses, as encoded in cmsis-dap transfer requests */
+	AP_CSW		= 0x01,
+	AP_TAR		= 0x05,
+	AP_DRW		= 0x0d,
+	/* the read request bit in cmsis-dap transfer requests */
+	RnW		= 1 << 1,
+	/* 32 bit accesses, with single address increment */
+	CSW_VALUE	= 0x23000012,
+};
+
+static uint8_t request[CMSIS_DAP_PACKET_SIZE], response[CMSIS_DAP_PACKET_SIZE] __attribute__((aligned(4)));
+static int failures;
+
+/* statistics for a single benchmark phase */
+static struct
+{
+	const char *	name;
+	uint64_t	requests, words;
+	struct swd_target_stats	start;
+}
+phase;
+
+static void phase_begin(const char * name)
+{
+	phase.name = name;
+	phase.requests = phase.words = 0;
+	phase.start = swd_target_stats;
+}
+
+static void phase_end(void)
+{
+uint64_t packets = swd_target_stats.packets - phase.start.packets;
+uint64_t cycles = swd_target_stats.clock_cycles - phase.start.clock_cycles;
+
+	printf("%-28s %8llu %8llu %10llu %10llu", phase.name, (unsigned long long) phase.requests,
+			(unsigned long long) packets, (unsigned long long) cycles, (unsigned long long) phase.words);
+	if (phase.requests)
+		printf(" %8.2f", (double) packets / phase.requests);
+	else
+		printf(" %8s", "-");
+	if (phase.words)
+		printf(" %8.2f", (double) cycles / phase.words);
+	printf("\n");
+}
+
+static void fail(const char * message)
+{
+	printf("FAILED: %s - %s\n", phase.name, message);
+	failures ++;
+}
+
+static void put_word(uint8_t * p, uint32_t x)
+{
+	p[0] = x, p[1] = x >> 8, p[2] = x >> 16, p[3] = x >> 24;
+}
+
+static uint32_t get_word(const uint8_t * p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+/* executes the request built in 'request', and returns the response length */
+static int execute(void)
+{
+	phase.requests ++;
+	return cmsis_dap_process_request(request, response, CMSIS_DAP_PACKET_SIZE);
+}
+
+/* sets the mem-ap CSW and TAR registers */
+static void set_address(uint32_t addr)
+{
+uint8_t * p = request;
+
+	* p ++ = ID_DAP_Transfer;
+	* p ++ = 0;
+	* p ++ = 2;
+	* p ++ = AP_CSW;
+	put_word(p, CSW_VALUE), p += 4;
+	* p ++ = AP_TAR;
+	put_word(p, addr), p += 4;
+	execute();
+	if (response[1] != 2 || response[2] != 1)
+		fail("setting the transfer address failed");
+}
+
+/* the number of words that can be transferred in a single block transfer,
+ * without crossing a 1 kbyte boundary - the TAR register only auto
+ * increments within such a boundary */
+static int block_words(uint32_t addr, int max_words, int remaining)
+{
+int n = (1024 - (addr & 1023)) / 4;
+
+	if (n > max_words)
+		n = max_words;
+	return n < remaining ? n : remaining;
+}
+
+static uint32_t test_pattern(int i)
+{
+	return 0x9e3779b9 * (i + 1);
+}
+
+static void connect(const char * phase_name)
+{
+	phase_begin(phase_name);
+	request[0] = ID_DAP_Connect;
+	request[1] = 1;
+	execute();
+	if (response[0] != ID_DAP_Connect || response[1] != 1)
+		fail("connecting failed");
+	request[0] = ID_DAP_TransferConfigure;
+	request[1] = 0;
+	request[2] = 100, request[3] = 0;
+	request[4] = 0, request[5] = 0;
+	execute();
+	phase_end();
+}
+
+static void block_write(int word_count)
+{
+int i, n;
+uint32_t addr = SWD_TARGET_RAM_BASE;
+uint8_t * p;
+
+	phase_begin("TransferBlock write");
+	for (i = 0; i < word_count; i += n, addr += n * 4)
+	{
+		n = block_words(addr, (CMSIS_DAP_PACKET_SIZE - 5) / 4, word_count - i);
+		set_address(addr);
+		p = request;
+		* p ++ = ID_DAP_TransferBlock;
+		* p ++ = 0;
+		* p ++ = n, * p ++ = n >> 8;
+		* p ++ = AP_DRW;
+		for (int j = 0; j < n; j ++)
+			put_word(p, test_pattern(i + j)), p += 4;
+		execute();
+		if ((response[1] | response[2] << 8) != n || response[3] != 1)
+		{
+			fail("block write failed");
+			break;
+		}
+		phase.words += n;
+	}
+	for (i = 0; i < word_count; i ++)
+		if (get_word(swd_target_ram + i * 4) != test_pattern(i))
+		{
+			fail("target memory contents mismatch");
+			break;
+		}
+	phase_end();
+}
+
+static void block_read(int word_count)
+{
+int i, n;
+uint32_t addr = SWD_TARGET_RAM_BASE;
+
+	phase_begin("TransferBlock read");
+	for (i = 0; i < word_count; i += n, addr += n * 4)
+	{
+		n = block_words(addr, (CMSIS_DAP_PACKET_SIZE - 4) / 4, word_count - i);
+		set_address(addr);
+		request[0] = ID_DAP_TransferBlock;
+		request[1] = 0;
+		request[2] = n, request[3] = n >> 8;
+		request[4] = AP_DRW | RnW;
+		if (execute() != 4 + n * 4 || (response[1] | response[2] << 8) != n || response[3] != 1)
+		{
+			fail("block read failed");
+			break;
+		}
+		for (int j = 0; j < n; j ++)
+			if (get_word(response + 4 + j * 4) != test_pattern(i + j))
+			{
+				fail("data read mismatch");
+				i = word_count;
+				break;
+			}
+		phase.words += n;
+	}
+	phase_end();
+}
+
+/* reads the target memory with DAP_Transfer requests, each one carrying
+ * as many ap reads as fit in a response */
+static void transfer_read(int word_count)
+{
+int i, n;
+uint32_t addr = SWD_TARGET_RAM_BASE;
+
+	phase_begin("Transfer read");
+	for (i = 0; i < word_count; i += n, addr += n * 4)
+	{
+		n = block_words(addr, (CMSIS_DAP_PACKET_SIZE - 3) / 4, word_count - i);
+		if (n > 255)
+			n = 255;
+		set_address(addr);
+		request[0] = ID_DAP_Transfer;
+		request[1] = 0;
+		request[2] = n;
+		memset(request + 3, AP_DRW | RnW, n);
+		if (execute() != 3 + n * 4 || response[1] != n || response[2] != 1)
+		{
+			fail("transfer read failed");
+			break;
+		}
+		for (int j = 0; j < n; j ++)
+			if (get_word(response + 3 + j * 4) != test_pattern(i + j))
+			{
+				fail("data read mismatch");
+				i = word_count;
+				break;
+			}
+		phase.words += n;
+	}
+	phase_end();
+}
+
+/* checks that an access to an unmapped address is reported as a fault,
+ * and that the probe recovers from it; ap reads are posted, so the
+ * failed read is only reported by the next ap access */
+static void fault_recovery(void)
+{
+	phase_begin("fault recovery");
+	set_address(0x40000000);
+	request[0] = ID_DAP_Transfer;
+	request[1] = 0;
+	request[2] = 2;
+	request[3] = AP_DRW | RnW;
+	request[4] = AP_CSW | RnW;
+	execute();
+	if (response[1] != 0 || (response[2] & 7) != 4)
+		fail("an access to an unmapped address was not reported as a fault");
+	set_address(SWD_TARGET_RAM_BASE);
+	request[0] = ID_DAP_Transfer;
+	request[1] = 0;
+	request[2] = 1;
+	request[3] = AP_DRW | RnW;
+	execute();
+	if (response[1] != 1 || response[2] != 1 || get_word(response + 3) != test_pattern(0))
+		fail("no recovery after a failed transfer");
+	phase_end();
+}
+
+/* issues a jtag to serial wire switching sequence with ID_DAP_SWJ_Sequence,
+ * then reads the dp IDCODE register, as debuggers do when attaching; the
+ * target is already in serial wire mode, so it only sees the line resets
+ * before and after the switching sequence */
+static void swj_sequence(void)
+{
+uint64_t line_resets = swd_target_stats.line_resets;
+static const uint8_t jtag_to_sw[] =
+{
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0x9e, 0xe7,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0x00,
+};
+
+	phase_begin("SWJ_Sequence");
+	request[0] = ID_DAP_SWJ_Sequence;
+	request[1] = sizeof jtag_to_sw * 8;
+	memcpy(request + 2, jtag_to_sw, sizeof jtag_to_sw);
+	if (execute() != 2 || response[1] != 0)
+		fail("the sequence was not accepted");
+	request[0] = ID_DAP_Transfer;
+	request[1] = 0;
+	request[2] = 1;
+	request[3] = RnW;
+	execute();
+	if (response[1] != 1 || response[2] != 1 || get_word(response + 3) != SWD_TARGET_IDCODE)
+		fail("reading the IDCODE register after the sequence failed");
+	if (swd_target_stats.line_resets - line_resets != 2)
+		fail("the sequence was not clocked out correctly");
+	phase_end();
+}
+
+/* pulses the target reset line with ID_DAP_SWJ_Pins, and checks the pin
+ * levels read back; the target model keeps running, so the serial wire
+ * connection must still work afterwards */
+static void swj_pins(void)
+{
+	phase_begin("SWJ_Pins");
+	request[0] = ID_DAP_SWJ_Pins;
+	request[1] = 0;
+	request[2] = 1 << 7;
+	put_word(request + 3, 0);
+	execute();
+	if (response[1] != ((1 << 0) | (1 << 1)))
+		fail("asserting the target reset failed");
+	request[1] = 1 << 7;
+	put_word(request + 3, 1000);
+	execute();
+	if (response[1] != ((1 << 0) | (1 << 1) | (1 << 7)))
+		fail("releasing the target reset failed");
+	request[0] = ID_DAP_Transfer;
+	request[1] = 0;
+	request[2] = 1;
+	request[3] = RnW;
+	execute();
+	if (response[1] != 1 || response[2] != 1 || get_word(response + 3) != SWD_TARGET_IDCODE)
+		fail("the serial wire connection was lost");
+	phase_end();
+}
+
+/* executes a command batch built in 'request', and checks that the response
+ * does not run past the end of the response packet */
+static int execute_batch(void)
+{
+static uint8_t batch_response[CMSIS_DAP_PACKET_SIZE + 64] __attribute__((aligned(4)));
+int i, length;
+
+	memset(batch_response, 0xa5, sizeof batch_response);
+	phase.requests ++;
+	length = cmsis_dap_process_request(request, batch_response, CMSIS_DAP_PACKET_SIZE);
+	for (i = CMSIS_DAP_PACKET_SIZE; i < (int) sizeof batch_response; i ++)
+		if (batch_response[i] != 0xa5)
+		{
+			fail("the response runs past the end of the response packet");
+			break;
+		}
+	if (length > CMSIS_DAP_PACKET_SIZE)
+		fail("the response is longer than the response packet");
+	memcpy(response, batch_response, CMSIS_DAP_PACKET_SIZE);
+	return length;
+}
+
+/* executes a single byte argument command, and checks that it succeeded */
+static void swo_command(int command, int argument, bool is_success_expected)
+{
+	request[0] = command;
+	request[1] = argument;
+	if (execute() != 2 || (response[1] == 0) != is_success_expected)
+		fail(is_success_expected ? "a trace configuration command failed" : "a trace configuration command did not fail");
+}
+
+/* reads all trace data from the probe with ID_DAP_SWO_Data, and checks it
+ * against the data fed to the simulated swo phy */
+static void swo_read_check(const uint8_t * expected, int count)
+{
+int n;
+
+	while (count)
+	{
+		request[0] = ID_DAP_SWO_Data;
+		request[1] = 0xff, request[2] = 0xff;
+		execute();
+		n = response[2] | response[3] << 8;
+		if (!n || n > count || memcmp(response + 4, expected, n))
+		{
+			fail("trace data read back does not match");
+			return;
+		}
+		expected += n;
+		count -= n;
+	}
+}
+
+/* captures trace data, and reads it back with ID_DAP_SWO_Data - the second
+ * batch of trace data wraps around the end of the trace buffer, and the
+ * third one overruns the trace buffer */
+static void swo_capture(void)
+{
+static uint8_t trace[SWO_BUFFER_SIZE + 16];
+int i;
+
+	phase_begin("SWO capture");
+	for (i = 0; i < (int) sizeof trace; i ++)
+		trace[i] = test_pattern(i) >> 24;
+	swo_command(ID_DAP_SWO_Transport, SWO_TRANSPORT_DAP_COMMAND, true);
+	swo_command(ID_DAP_SWO_Mode, SWO_MODE_MANCHESTER, false);
+	swo_command(ID_DAP_SWO_Mode, SWO_MODE_UART, true);
+	request[0] = ID_DAP_SWO_Baudrate;
+	put_word(request + 1, 2000000);
+	if (execute() != 5 || get_word(response + 1) != 2000000)
+		fail("setting the baudrate failed");
+	swo_command(ID_DAP_SWO_Control, 1, true);
+	swo_command(ID_DAP_SWO_Mode, SWO_MODE_UART, false);
+
+	swo_sim_receive(trace, 100);
+	request[0] = ID_DAP_SWO_Status;
+	if (execute() != 6 || response[1] != SWO_STATUS_ACTIVE || get_word(response + 2) != 100)
+		fail("wrong trace status");
+	swo_read_check(trace, 100);
+	swo_sim_receive(trace, SWO_BUFFER_SIZE - 50);
+	swo_read_check(trace, SWO_BUFFER_SIZE - 50);
+	/* in a command batch, the trace data returned must fit in the rest of the response */
+	swo_sim_receive(trace, 100);
+	request[0] = ID_DAP_ExecuteCommands;
+	request[1] = 2;
+	request[2] = ID_DAP_SWO_Status;
+	request[3] = ID_DAP_SWO_Data;
+	request[4] = 0xff, request[5] = 0xff;
+	execute_batch();
+	i = response[10] | response[11] << 8;
+	if (response[1] != 2 || i != (CMSIS_DAP_PACKET_SIZE - 12 < 100 ? CMSIS_DAP_PACKET_SIZE - 12 : 100)
+			|| memcmp(response + 12, trace, i))
+		fail("wrong trace data returned in a command batch");
+	swo_read_check(trace + i, 100 - i);
+	swo_sim_receive(trace, sizeof trace);
+	request[0] = ID_DAP_SWO_Data;
+	request[1] = 0xff, request[2] = 0xff;
+	execute();
+	if (response[1] != (SWO_STATUS_ACTIVE | SWO_STATUS_BUFFER_OVERRUN) || response[2] || response[3])
+		fail("a trace buffer overrun was not reported");
+
+	swo_command(ID_DAP_SWO_Control, 0, true);
+	request[0] = ID_DAP_SWO_Status;
+	execute();
+	if (response[1] & SWO_STATUS_ACTIVE)
+		fail("trace capture did not stop");
+	phase_end();
+}
+
+/* command batches whose responses do not fit in a response packet must be cut short */
+static void command_batches(void)
+{
+int i, n;
+
+	phase_begin("command batches");
+	/* DAP_Info commands - a two byte request, and a three byte response each */
+	n = (CMSIS_DAP_PACKET_SIZE - 2) / 2;
+	if (n > 255)
+		n = 255;
+	request[0] = ID_DAP_ExecuteCommands;
+	request[1] = n;
+	for (i = 0; i < n; i ++)
+		request[2 + 2 * i] = ID_DAP_Info, request[3 + 2 * i] = 0xf0;
+	execute_batch();
+	/* a command is only executed if its longest (six byte) response fits */
+	if (response[1] != ((CMSIS_DAP_PACKET_SIZE - 8) / 3 + 1 < n ? (CMSIS_DAP_PACKET_SIZE - 8) / 3 + 1 : n))
+		fail("wrong number of DAP_Info commands executed");
+
+	/* a DAP_Transfer command with more ap reads than fit in the response */
+	set_address(SWD_TARGET_RAM_BASE);
+	request[0] = ID_DAP_ExecuteCommands;
+	request[1] = 1;
+	request[2] = ID_DAP_Transfer;
+	request[3] = 0;
+	request[4] = 255;
+	memset(request + 5, AP_DRW | (1 << 1), CMSIS_DAP_PACKET_SIZE - 5);
+	execute_batch();
+	if (response[1] != 1 || response[3] != (CMSIS_DAP_PACKET_SIZE - 5) / 4 || response[4] != 1)
+		fail("wrong number of DAP_Transfer reads executed");
+
+	/* a DAP_Transfer command that runs past the end of the request */
+	request[4] = 255;
+	memset(request + 5, AP_DRW, CMSIS_DAP_PACKET_SIZE - 5);
+	for (i = 5; i + 5 <= CMSIS_DAP_PACKET_SIZE; i += 5)
+		request[i] = AP_DRW, put_word(request + i + 1, i);
+	execute_batch();
+	if (response[1] != 1 || response[3] != (CMSIS_DAP_PACKET_SIZE - 5) / 5 || response[4] != 1)
+		fail("wrong number of DAP_Transfer writes executed");
+
+	/* a DAP_TransferBlock command with more reads than fit in the response */
+	set_address(SWD_TARGET_RAM_BASE);
+	request[0] = ID_DAP_ExecuteCommands;
+	request[1] = 2;
+	request[2] = ID_DAP_TransferBlock;
+	request[3] = 0;
+	request[4] = 0xff, request[5] = 0xff;
+	request[6] = AP_DRW | (1 << 1);
+	request[7] = ID_DAP_Info;
+	request[8] = 0xf0;
+	execute_batch();
+	if (response[1] != 1 || (response[3] | response[4] << 8) != (CMSIS_DAP_PACKET_SIZE - 6) / 4 || response[5] != 1)
+		fail("wrong number of DAP_TransferBlock reads executed");
+	phase_end();
+}
+
+/* the end of requests transferred as several usb packets is located by
+ * parsing the requests; each request here spans two usb packets */
+static void request_length(void)
+{
+static uint8_t req[128];
+int i;
+
+	phase_begin("request length");
+	/* a DAP_Transfer request with 25 writes */
+	req[0] = ID_DAP_Transfer;
+	req[1] = 0;
+	req[2] = 25;
+	for (i = 3; i < 128; i += 5)
+		req[i] = AP_DRW;
+	if (cmsis_dap_request_length(req, 64) || cmsis_dap_request_length(req, 128) != 128)
+		fail("wrong DAP_Transfer request length");
+	/* a DAP_ExecuteCommands request with a DAP_TransferBlock write of
+	 * 29 words, and a DAP_Transfer read */
+	req[0] = ID_DAP_ExecuteCommands;
+	req[1] = 2;
+	req[2] = ID_DAP_TransferBlock;
+	req[3] = 0;
+	req[4] = 29, req[5] = 0;
+	req[6] = AP_DRW;
+	req[123] = ID_DAP_Transfer;
+	req[124] = 0;
+	req[125] = 1;
+	req[126] = AP_DRW | (1 << 1);
+	req[127] = 0;
+	if (cmsis_dap_request_length(req, 64) || cmsis_dap_request_length(req, 126)
+			|| cmsis_dap_request_length(req, 128) != 127)
+		fail("wrong DAP_ExecuteCommands request length");
+	phase_end();
+}
+
+static void unknown_command(void)
+{
+	phase_begin("unknown command");
+	request[0] = ID_DAP_JTAG_IDCODE;
+	if (execute() != 1 || response[0] != ID_DAP_Invalid)
+		fail("unknown command not answered with DAP_Invalid");
+	phase_end();
+}
+
+int main(int argc, char ** argv)
+{
+int opt, word_count = 4096;
+
+	swd_target_power_on_reset();
+	while ((opt = getopt(argc, argv, "n:w:p:")) != -1)
+		switch (opt)
+		{
+			case 'n':
+				word_count = atoi(optarg);
+				break;
+			case 'w':
+				swd_target_inject_waits(atoi(optarg));
+				break;
+			case 'p':
+				swd_target_inject_parity_errors(atoi(optarg));
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-n word_count] [-w wait_interval] [-p parity_error_interval]\n", argv[0]);
+				return 2;
+		}
+	if (word_count < 1 || word_count > SWD_TARGET_RAM_SIZE / 4)
+	{
+		fprintf(stderr, "the word count must be between 1 and %d\n", SWD_TARGET_RAM_SIZE / 4);
+		return 2;
+	}
+
+	printf("cmsis-dap packet size: %d bytes\n\n", CMSIS_DAP_PACKET_SIZE);
+	printf("%-28s %8s %8s %10s %10s %8s %8s\n", "phase", "requests", "sw xfers", "clocks", "words", "xfers/rq", "clk/word");
+	connect("connect");
+	block_write(word_count);
+	block_read(word_count);
+	transfer_read(word_count);
+	fault_recovery();
+	/* the target domains are still powered up now */
+	connect("reconnect");
+	swj_sequence();
+	swj_pins();
+	swo_capture();
+	command_batches();
+	request_length();
+	unknown_command();
+
+	if (swd_target_stats.misframed_requests || swd_target_stats.lockout_requests
+			|| swd_target_stats.parity_errors || swd_target_stats.contention_cycles)
+	{
+		printf("FAILED: serial wire protocol violations - %llu misframed requests, %llu requests during lockout, "
+				"%llu parity errors, %llu contention cycles\n",
+				(unsigned long long) swd_target_stats.misframed_requests,
+				(unsigned long long) swd_target_stats.lockout_requests,
+				(unsigned long long) swd_target_stats.parity_errors,
+				(unsigned long long) swd_target_stats.contention_cycles);
+		failures ++;
+	}
+	printf("\n%s\n", failures ? "FAILED" : "all tests passed");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,52 @@
+/*
+Copyright (c) 2015-2016 stoyan shopov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* a minimal stand-in for the libopencm3 gpio header, for host builds -
+ * only the definitions used by the probe sources are provided here;
+ * the gpio routines are implemented in mock-hw.c */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define GPIOA				0x40010800
+#define GPIOB				0x40010c00
+
+#define GPIO5				(1 << 5)
+#define GPIO6				(1 << 6)
+#define GPIO13				(1 << 13)
+#define GPIO15				(1 << 15)
+
+#define GPIO_MODE_INPUT			0
+#define GPIO_MODE_OUTPUT_10_MHZ		1
+#define GPIO_MODE_OUTPUT_2_MHZ		2
+#define GPIO_MODE_OUTPUT_50_MHZ		3
+
+#define GPIO_CNF_INPUT_ANALOG		0
+#define GPIO_CNF_INPUT_FLOAT		1
+#define GPIO_CNF_INPUT_PULL_UPDOWN	2
+#define GPIO_CNF_OUTPUT_PUSHPULL	0
+#define GPIO_CNF_OUTPUT_OPENDRAIN	1
+
+void gpio_set(uint32_t gpioport, uint16_t gpios);
+void gpio_clear(uint32_t gpioport, uint16_t gpios);
+uint16_t gpio_get(uint32_t gpioport, uint16_t gpios);
+void gpio_set_mode(uint32_t gpioport, uint8_t mode, uint8_t cnf, uint16_t gpios);
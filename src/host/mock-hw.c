@@ -0,0 +1,81 @@
+/*
+Copyright (c) 2015-2016 stoyan shopov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* mock implementations of the libopencm3 routines used by the probe
+ * sources, for host builds - the gpio ports are plain variables, and the
+ * systick counter advances by a fixed amount on each read, so that busy
+ * wait loops terminate without consuming real time */
+
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/cm3/systick.h>
+
+enum
+{
+	/* the number of systick counts that pass on each counter read */
+	SYSTICK_COUNTS_PER_READ		= 72,
+};
+
+/* the output data registers of gpio ports a and b */
+static uint16_t gpio_odr[2];
+static uint32_t systick_value = 0xffffff;
+
+static uint16_t * gpio_port(uint32_t gpioport)
+{
+	return & gpio_odr[gpioport == GPIOB];
+}
+
+void gpio_set(uint32_t gpioport, uint16_t gpios)
+{
+	* gpio_port(gpioport) |= gpios;
+}
+
+void gpio_clear(uint32_t gpioport, uint16_t gpios)
+{
+	* gpio_port(gpioport) &= ~gpios;
+}
+
+/* the pins read back the levels driven on them */
+uint16_t gpio_get(uint32_t gpioport, uint16_t gpios)
+{
+	return * gpio_port(gpioport) & gpios;
+}
+
+void gpio_set_mode(uint32_t gpioport, uint8_t mode, uint8_t cnf, uint16_t gpios)
+{
+}
+
+void systick_set_clocksource(uint8_t clocksource)
+{
+}
+
+void systick_set_reload(uint32_t value)
+{
+}
+
+void systick_counter_enable(void)
+{
+}
+
+uint32_t systick_get_value(void)
+{
+	return systick_value = (systick_value - SYSTICK_COUNTS_PER_READ) & 0xffffff;
+}
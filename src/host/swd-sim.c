@@ -0,0 +1,134 @@
+/*
+Copyright (c) 2015-2016 stoyan shopov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* the simulated serial wire phy, used instead of swd-hw.c in host builds;
+ * this provides the same interface to swd.c as swd-hw.c does, but the
+ * serial wire is connected to the target model in swd-target.c
+ *
+ * this file is included by swd.c, and must not be compiled on its own */
+
+#include "swd-target.h"
+
+/* the serial wire clock rate last requested, it has no effect on the simulation */
+static uint32_t sim_swclk_hz;
+
+static inline void swdelay(void)
+{
+}
+
+uint32_t sw_set_clock(uint32_t hz)
+{
+	sim_swclk_hz = hz;
+	nr_swd_idle_cycles = 0;
+	return hz;
+}
+
+static void sw_phy_init(void)
+{
+}
+
+static inline void sw_config_swdio_output(void)
+{
+}
+
+static inline void sw_clock_out_0(void)
+{
+	swd_target_clock(true, false);
+}
+
+static inline void sw_clock_out_1(void)
+{
+	swd_target_clock(true, true);
+}
+
+/* the levels last driven with sw_phy_set_pins() - the serial wire pins are
+ * not modelled at this level, so these are just read back */
+static int sim_pins = SW_PIN_SWCLK | SW_PIN_SWDIO;
+
+static inline void sw_phy_set_pins(int pin_output, int pin_select)
+{
+	sim_pins = (sim_pins & ~pin_select) | (pin_output & pin_select);
+}
+
+static inline int sw_phy_get_pins(void)
+{
+	return sim_pins;
+}
+
+static inline void sw_turnaround_to_output(void)
+{
+	swd_target_clock(false, 0);
+}
+
+static void sw_insert_idle_cycles(int nr_idle_cycles)
+{
+	while (nr_idle_cycles-- > 0)
+		swd_target_clock(true, false);
+}
+
+/* the routines below have the same interface as the assembly language
+ * bit loops in swd-hw.c - see there for details */
+
+static inline uint32_t sw_clock_header_out_get_ack(uint32_t w)
+{
+uint32_t ack = 0;
+int i;
+	swd_target_request_start();
+	for (i = 0; i < 8; i ++, w >>= 1)
+		swd_target_clock(true, w & 1);
+	/* issue a turnaround cycle */
+	swd_target_clock(false, 0);
+	/* read the 3-bit ack value */
+	for (i = 0; i < 3; i ++)
+		ack |= swd_target_clock(false, 0) << i;
+	return ack;
+}
+
+static inline uint64_t sw_clock_word_and_parity_in(void)
+{
+uint32_t x = 0;
+bool parity;
+int i;
+	for (i = 0; i < 32; i ++)
+		x |= (uint32_t) swd_target_clock(false, 0) << i;
+	parity = swd_target_clock(false, 0);
+	/* issue a turnaround cycle */
+	swd_target_clock(false, 0);
+	return x | (uint64_t) (parity ^ __builtin_parity(x)) << 32;
+}
+
+static inline void sw_clock_bits_out(uint32_t w, int bit_count)
+{
+	for (; bit_count; bit_count --, w >>= 1)
+		swd_target_clock(true, w & 1);
+}
+
+static inline void sw_clock_word_and_parity_out(uint32_t w)
+{
+int i;
+bool parity = __builtin_parity(w);
+	/* issue a turnaround cycle */
+	swd_target_clock(false, 0);
+	for (i = 0; i < 32; i ++, w >>= 1)
+		swd_target_clock(true, w & 1);
+	swd_target_clock(true, parity);
+}
@@ -0,0 +1,532 @@
+/*
+Copyright (c) 2015-2016 stoyan shopov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* a software model of an adiv5 serial wire debug port - see swd-target.h */
+
+#include <string.h>
+#include "swd-target.h"
+
+enum
+{
+	/* the minimum number of consecutive high swdio cycles in a line reset */
+	LINE_RESET_CYCLES	= 50,
+	/* the jtag to serial wire switching sequence, lsb first */
+	JTAG_TO_SW_SEQUENCE	= 0xe79e,
+	/* the number of dp CTRL/STAT register reads after a power-up request,
+	 * before the power-up gets acknowledged */
+	POWER_UP_LATENCY	= 3,
+
+	/* dp CTRL/STAT register bits */
+	CSYSPWRUPACK	= 1 << 31,
+	CSYSPWRUPREQ	= 1 << 30,
+	CDBGPWRUPACK	= 1 << 29,
+	CDBGPWRUPREQ	= 1 << 28,
+	CDBGRSTACK	= 1 << 27,
+	CDBGRSTREQ	= 1 << 26,
+	WDATAERR	= 1 << 7,
+	STICKYERR	= 1 << 5,
+	STICKYCMP	= 1 << 4,
+	STICKYORUN	= 1 << 1,
+	/* dp ABORT register bits */
+	ORUNERRCLR	= 1 << 4,
+	WDERRCLR	= 1 << 3,
+	STKERRCLR	= 1 << 2,
+	STKCMPCLR	= 1 << 1,
+
+	/* the serial wire acknowledge values */
+	ACK_OK		= 1,
+	ACK_WAIT	= 2,
+	ACK_FAULT	= 4,
+
+	/* mem-ap register values */
+	AP_IDR		= 0x24770011,
+	AP_BASE		= 0xe00ff003,
+};
+
+/* the serial wire protocol states */
+enum TARGET_STATE
+{
+	/* in jtag mode, waiting for the jtag to serial wire switching sequence */
+	TARGET_JTAG,
+	/* ignoring everything until a line reset completes - this state is
+	 * entered on protocol errors, and while a line reset is in progress */
+	TARGET_LOCKOUT,
+	/* waiting for the start bit of a packet request */
+	TARGET_IDLE,
+	/* receiving the packet request header */
+	TARGET_HEADER,
+	/* the turnaround cycle before the acknowledge phase */
+	TARGET_TURNAROUND_ACK,
+	/* driving the acknowledge phase */
+	TARGET_ACK,
+	/* driving the read data phase */
+	TARGET_READ_DATA,
+	/* the turnaround cycle before the write data phase */
+	TARGET_TURNAROUND_WRITE,
+	/* receiving the write data phase */
+	TARGET_WRITE_DATA,
+	/* the turnaround cycle after the acknowledge phase of a failed
+	 * request, or after the read data phase */
+	TARGET_TURNAROUND_IDLE,
+};
+
+struct swd_target_stats swd_target_stats;
+uint8_t swd_target_ram[SWD_TARGET_RAM_SIZE];
+
+static struct
+{
+	enum TARGET_STATE	state;
+	/* the number of consecutive high swdio cycles seen */
+	int		ones;
+	/* the number of jtag to serial wire switching sequence bits
+	 * received so far, or -1 if none is being received */
+	int		sequence_bits;
+	uint32_t	sequence;
+	/* true, if the dp has not been accessed since the last line reset - only
+	 * an IDCODE read is accepted then */
+	bool		is_idcode_read_needed;
+	/* the bit counter, and the shift register, for the current protocol phase */
+	int		bit_count;
+	uint64_t	shift;
+	/* the bits of the current packet request header */
+	bool		is_ap_access, is_read_access;
+	int		a32;
+	uint32_t	ack;
+	/* the dp registers */
+	uint32_t	ctrl_stat, select, rdbuff;
+	/* the number of dp CTRL/STAT register reads left, before a pending
+	 * power-up request gets acknowledged */
+	int		power_up_countdown;
+	/* the mem-ap registers */
+	uint32_t	csw, tar;
+	/* if nonzero, every this many ap accesses are acknowledged with a 'wait' once */
+	int		wait_interval, wait_counter;
+	bool		is_wait_pending;
+	/* the data returned by the last ap read, or dp RDBUFF read - this is
+	 * returned again by a read of the dp RESEND register */
+	uint32_t	resend_data;
+	/* if nonzero, the parity bit of every this many ap and dp RDBUFF reads
+	 * is inverted, as if the data got corrupted on the wire */
+	int		parity_error_interval, parity_error_counter;
+}
+target;
+
+/*!
+ *	\fn	void swd_target_power_on_reset(void)
+ *	\brief	resets the target model to its power on state - in jtag mode, with the debug domains powered down */
+void swd_target_power_on_reset(void)
+{
+int wait_interval = target.wait_interval, parity_error_interval = target.parity_error_interval;
+
+	memset(& target, 0, sizeof target);
+	target.wait_interval = wait_interval;
+	target.parity_error_interval = parity_error_interval;
+	target.state = TARGET_JTAG;
+	target.sequence_bits = -1;
+	memset(& swd_target_stats, 0, sizeof swd_target_stats);
+}
+
+/*!
+ *	\fn	void swd_target_inject_waits(int interval)
+ *	\brief	makes the target acknowledge every 'interval'-th ap access with a 'wait' response, once; zero disables this */
+void swd_target_inject_waits(int interval)
+{
+	target.wait_interval = interval;
+	target.wait_counter = 0;
+}
+
+/*!
+ *	\fn	void swd_target_inject_parity_errors(int interval)
+ *	\brief	makes the target send a bad parity bit on every 'interval'-th ap and dp RDBUFF read; zero disables this */
+void swd_target_inject_parity_errors(int interval)
+{
+	target.parity_error_interval = interval;
+	target.parity_error_counter = 0;
+}
+
+/*!
+ *	\fn	void swd_target_request_start(void)
+ *	\brief	notifies the target model that the probe is about to send a packet request
+ *
+ *	this is only used for verifying that the probe and the target agree on
+ *	the protocol state - the target must be idle at the start of a request */
+void swd_target_request_start(void)
+{
+	if (target.state != TARGET_IDLE)
+		swd_target_stats.misframed_requests ++;
+}
+
+/* the mem-ap memory map */
+static bool mem_read(uint32_t addr, uint32_t * data)
+{
+	addr &= ~3;
+	if (addr - SWD_TARGET_ROM_BASE < SWD_TARGET_ROM_SIZE)
+		* data = 0;
+	else if (addr - SWD_TARGET_RAM_BASE < SWD_TARGET_RAM_SIZE)
+		memcpy(data, swd_target_ram + addr - SWD_TARGET_RAM_BASE, sizeof * data);
+	else
+		return false;
+	return true;
+}
+
+static bool mem_write(uint32_t addr, uint32_t data)
+{
+int size = 1 << (target.csw & 3), lane = addr & 3;
+
+	if (addr - SWD_TARGET_ROM_BASE < SWD_TARGET_ROM_SIZE)
+		return true;
+	if (addr - SWD_TARGET_RAM_BASE >= SWD_TARGET_RAM_SIZE)
+		return false;
+	/* data is placed on the byte lanes given by the address */
+	if (size == 4)
+		lane = 0;
+	memcpy(swd_target_ram + (addr & ~(size - 1)) - SWD_TARGET_RAM_BASE, (uint8_t *) & data + lane, size);
+	return true;
+}
+
+/* increments the TAR register, if enabled in the CSW register; only
+ * the low 10 bits of the TAR register are incremented */
+static void tar_increment(void)
+{
+	if (((target.csw >> 4) & 3) == 1)
+		target.tar = (target.tar & ~0x3ff) | ((target.tar + (1 << (target.csw & 3))) & 0x3ff);
+}
+
+static void ap_access(uint32_t * data)
+{
+int reg = (target.select & 0xf0) | target.a32 << 2;
+bool is_ok = true;
+
+	if ((target.select >> 24) != 0)
+	{
+		/* there is only one ap - reads from other aps return zero */
+		* data = 0;
+		return;
+	}
+	if (target.is_read_access)
+		switch (reg)
+		{
+			case 0x00: * data = target.csw; break;
+			case 0x04: * data = target.tar; break;
+			case 0x0c: is_ok = mem_read(target.tar, data); tar_increment(); break;
+			case 0xf8: * data = AP_BASE; break;
+			case 0xfc: * data = AP_IDR; break;
+			default: * data = 0; break;
+		}
+	else
+		switch (reg)
+		{
+			case 0x00: target.csw = (* data & ~0x7) | ((* data & 7) > 2 ? 2 : (* data & 7)); break;
+			case 0x04: target.tar = * data; break;
+			case 0x0c: is_ok = mem_write(target.tar, * data); tar_increment(); break;
+		}
+	if (!is_ok)
+	{
+		* data = 0;
+		target.ctrl_stat |= STICKYERR;
+	}
+}
+
+/* performs the register access for the current packet request - ap reads are posted */
+static void register_access(uint32_t * data)
+{
+uint32_t x;
+
+	if (target.is_ap_access)
+	{
+		if (target.is_read_access)
+		{
+			ap_access(& x);
+			* data = target.resend_data = target.rdbuff;
+			target.rdbuff = x;
+			swd_target_stats.ap_reads ++;
+		}
+		else
+		{
+			ap_access(data);
+			swd_target_stats.ap_writes ++;
+		}
+		return;
+	}
+	if (target.is_read_access)
+	{
+		swd_target_stats.dp_reads ++;
+		switch (target.a32)
+		{
+			case 0: * data = SWD_TARGET_IDCODE; break;
+			case 1:
+				if (target.select & 1)
+				{
+					* data = 0;
+					break;
+				}
+				if (target.power_up_countdown && !-- target.power_up_countdown)
+					target.ctrl_stat |= (target.ctrl_stat & (CSYSPWRUPREQ | CDBGPWRUPREQ)) << 1;
+				* data = target.ctrl_stat;
+				break;
+			case 2: * data = target.resend_data; break;
+			case 3: * data = target.resend_data = target.rdbuff; break;
+		}
+		return;
+	}
+	swd_target_stats.dp_writes ++;
+	switch (target.a32)
+	{
+		case 0:
+			if (* data & ORUNERRCLR)
+				target.ctrl_stat &= ~STICKYORUN;
+			if (* data & WDERRCLR)
+				target.ctrl_stat &= ~WDATAERR;
+			if (* data & STKERRCLR)
+				target.ctrl_stat &= ~STICKYERR;
+			if (* data & STKCMPCLR)
+				target.ctrl_stat &= ~STICKYCMP;
+			break;
+		case 1:
+			if (target.select & 1)
+				/* the WCR register is not modelled */
+				break;
+			/* power-up requests are acknowledged after the CTRL/STAT register
+			 * has been read POWER_UP_LATENCY times, the other requests right away;
+			 * domains already powered up stay powered up */
+			x = * data & (CSYSPWRUPREQ | CDBGPWRUPREQ | CDBGRSTREQ);
+			target.ctrl_stat = (target.ctrl_stat & (WDATAERR | STICKYERR | STICKYCMP | STICKYORUN))
+				| x | (x & CDBGRSTREQ) << 1 | (target.ctrl_stat & (x << 1) & (CSYSPWRUPACK | CDBGPWRUPACK));
+			if ((target.ctrl_stat ^ target.ctrl_stat << 1) & (CSYSPWRUPACK | CDBGPWRUPACK))
+				target.power_up_countdown = POWER_UP_LATENCY;
+			else
+				target.power_up_countdown = 0;
+			break;
+		case 2:
+			target.select = * data;
+			break;
+	}
+}
+
+/* determines the acknowledge response to the packet request just received */
+static uint32_t request_ack(void)
+{
+	if (!target.is_ap_access)
+		return ACK_OK;
+	if (target.ctrl_stat & (STICKYERR | WDATAERR | STICKYORUN))
+		return ACK_FAULT;
+	if (target.wait_interval && !target.is_wait_pending && ++ target.wait_counter == target.wait_interval)
+	{
+		target.wait_counter = 0;
+		target.is_wait_pending = true;
+		return ACK_WAIT;
+	}
+	target.is_wait_pending = false;
+	if (!(target.ctrl_stat & CDBGPWRUPACK))
+	{
+		/* the access port is not powered */
+		target.ctrl_stat |= STICKYERR;
+		return ACK_FAULT;
+	}
+	return ACK_OK;
+}
+
+/* decodes a complete packet request header */
+static void header_received(void)
+{
+uint32_t h = target.shift;
+
+	swd_target_stats.packets ++;
+	target.is_ap_access = (h >> 1) & 1;
+	target.is_read_access = (h >> 2) & 1;
+	target.a32 = (h >> 3) & 3;
+	if (__builtin_parity((h >> 1) & 0xf) != ((h >> 5) & 1) || (h & (1 << 6)) || !(h & (1 << 7)))
+	{
+		/* malformed header - there is no response */
+		swd_target_stats.header_errors ++;
+		target.state = TARGET_LOCKOUT;
+		return;
+	}
+	if (target.is_idcode_read_needed)
+	{
+		if (target.is_ap_access || !target.is_read_access || target.a32)
+		{
+			swd_target_stats.lockout_requests ++;
+			target.state = TARGET_LOCKOUT;
+			return;
+		}
+		target.is_idcode_read_needed = false;
+	}
+	target.ack = request_ack();
+	if (target.ack == ACK_OK)
+		swd_target_stats.packets_ok ++;
+	target.state = TARGET_TURNAROUND_ACK;
+}
+
+/* returns the swdio level driven by the target in the current cycle */
+static bool target_output(void)
+{
+bool x;
+uint32_t data;
+
+	if (target.state == TARGET_ACK)
+	{
+		x = (target.ack >> target.bit_count) & 1;
+		if (++ target.bit_count == 3)
+		{
+			target.bit_count = 0;
+			if (target.ack != ACK_OK)
+				target.state = TARGET_TURNAROUND_IDLE;
+			else if (target.is_read_access)
+			{
+				register_access(& data);
+				target.shift = data | (uint64_t) __builtin_parity(data) << 32;
+				if ((target.is_ap_access || target.a32 == 3) && target.parity_error_interval
+						&& ++ target.parity_error_counter == target.parity_error_interval)
+				{
+					target.parity_error_counter = 0;
+					target.shift ^= (uint64_t) 1 << 32;
+				}
+				target.state = TARGET_READ_DATA;
+			}
+			else
+				target.state = TARGET_TURNAROUND_WRITE;
+		}
+		return x;
+	}
+	/* TARGET_READ_DATA */
+	x = (target.shift >> target.bit_count) & 1;
+	if (++ target.bit_count == 33)
+	{
+		target.bit_count = 0;
+		target.state = TARGET_TURNAROUND_IDLE;
+	}
+	return x;
+}
+
+/*!
+ *	\fn	bool swd_target_clock(bool is_probe_driving, bool swdio)
+ *	\brief	clocks the target model for a single serial wire clock cycle
+ *
+ *	\param	is_probe_driving	true, if the probe drives swdio in this cycle
+ *	\param	swdio	the swdio level driven by the probe, if it drives swdio
+ *	\return	the swdio level in this cycle - when neither the probe nor
+ *		the target drive swdio, it is pulled high */
+bool swd_target_clock(bool is_probe_driving, bool swdio)
+{
+bool is_line_reset_end;
+uint32_t data;
+
+	swd_target_stats.clock_cycles ++;
+	if (target.state == TARGET_ACK || target.state == TARGET_READ_DATA)
+	{
+		if (is_probe_driving)
+			swd_target_stats.contention_cycles ++;
+		target.ones = 0;
+		return target_output();
+	}
+	if (!is_probe_driving)
+		swdio = true;
+
+	is_line_reset_end = !swdio && target.ones >= LINE_RESET_CYCLES;
+	target.ones = swdio ? target.ones + 1 : 0;
+
+	if (target.state == TARGET_JTAG)
+	{
+		if (is_line_reset_end)
+			target.sequence_bits = 0;
+		if (target.sequence_bits >= 0)
+		{
+			target.sequence = target.sequence >> 1 | swdio << 15;
+			if (++ target.sequence_bits == 16)
+			{
+				if (target.sequence == JTAG_TO_SW_SEQUENCE)
+				{
+					swd_target_stats.jtag_to_sw_switches ++;
+					/* a line reset must follow */
+					target.state = TARGET_LOCKOUT;
+				}
+				target.sequence_bits = -1;
+			}
+		}
+		return swdio;
+	}
+	if (is_line_reset_end)
+	{
+		swd_target_stats.line_resets ++;
+		target.is_idcode_read_needed = true;
+		/* this cycle is the first idle cycle */
+		target.state = TARGET_IDLE;
+		return swdio;
+	}
+	if (target.ones >= LINE_RESET_CYCLES)
+	{
+		/* a line reset is in progress */
+		target.state = TARGET_LOCKOUT;
+		return swdio;
+	}
+
+	switch (target.state)
+	{
+		case TARGET_IDLE:
+			if (swdio)
+			{
+				/* start bit */
+				target.shift = 1;
+				target.bit_count = 1;
+				target.state = TARGET_HEADER;
+			}
+			break;
+		case TARGET_HEADER:
+			target.shift |= (uint64_t) swdio << target.bit_count;
+			if (++ target.bit_count == 8)
+			{
+				target.bit_count = 0;
+				header_received();
+			}
+			break;
+		case TARGET_TURNAROUND_ACK:
+			target.state = TARGET_ACK;
+			break;
+		case TARGET_TURNAROUND_WRITE:
+			target.shift = 0;
+			target.state = TARGET_WRITE_DATA;
+			break;
+		case TARGET_WRITE_DATA:
+			target.shift |= (uint64_t) swdio << target.bit_count;
+			if (++ target.bit_count == 33)
+			{
+				target.bit_count = 0;
+				target.state = TARGET_IDLE;
+				data = target.shift;
+				if (__builtin_parity(data) != (target.shift >> 32))
+				{
+					swd_target_stats.parity_errors ++;
+					target.ctrl_stat |= WDATAERR;
+				}
+				else
+					register_access(& data);
+			}
+			break;
+		case TARGET_TURNAROUND_IDLE:
+			target.state = TARGET_IDLE;
+			break;
+		default:
+			break;
+	}
+	return swdio;
+}
@@ -0,0 +1,81 @@
+/*
+Copyright (c) 2015-2016 stoyan shopov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* a software model of an adiv5 serial wire debug port (sw-dp), with a
+ * single ahb memory access port (mem-ap) connected to a memory map with
+ * a rom and a ram region; this is used by the host build of the probe
+ * firmware, in place of a physical target - see swd-sim.c
+ *
+ * the model is clocked one serial wire clock cycle at a time, and
+ * implements the serial wire protocol at the bit level, including
+ * the line reset and jtag to serial wire switching sequences, and the
+ * lockout of all requests other than an IDCODE read after a line reset;
+ * any deviation from the protocol by the probe is recorded in
+ * 'swd_target_stats' */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+enum
+{
+	/* the value read from the dp IDCODE register - a cortex-m3 sw-dp */
+	SWD_TARGET_IDCODE	= 0x1ba01477,
+	/* the rom region - it reads as zeros, writes to it are ignored */
+	SWD_TARGET_ROM_BASE	= 0x00000000,
+	SWD_TARGET_ROM_SIZE	= 0x10000,
+	/* the ram region */
+	SWD_TARGET_RAM_BASE	= 0x20000000,
+	SWD_TARGET_RAM_SIZE	= 0x10000,
+};
+
+struct swd_target_stats
+{
+	/* the number of serial wire clock cycles */
+	uint64_t	clock_cycles;
+	/* the number of packet requests received, and the number of these
+	 * acknowledged with an ok response */
+	uint64_t	packets, packets_ok;
+	/* the number of completed register accesses */
+	uint64_t	dp_reads, dp_writes, ap_reads, ap_writes;
+	/* the number of line resets, and of jtag to serial wire switching sequences */
+	uint64_t	line_resets, jtag_to_sw_switches;
+	/* the number of malformed packet requests - line resets and the jtag to
+	 * serial wire switching sequence also show up here, when received
+	 * in the idle state, so these are not necessarily errors */
+	uint64_t	header_errors;
+	/* the number of packet requests started by the probe while the target
+	 * was not waiting for one, of requests ignored because of a lockout,
+	 * and of data phases with a bad parity bit - these must always be zero */
+	uint64_t	misframed_requests, lockout_requests, parity_errors;
+	/* the number of clock cycles during which both the probe and the target
+	 * drove swdio - this must always be zero */
+	uint64_t	contention_cycles;
+};
+
+extern struct swd_target_stats swd_target_stats;
+extern uint8_t swd_target_ram[SWD_TARGET_RAM_SIZE];
+
+void swd_target_power_on_reset(void);
+void swd_target_inject_waits(int interval);
+void swd_target_inject_parity_errors(int interval);
+void swd_target_request_start(void);
+bool swd_target_clock(bool is_probe_driving, bool swdio);
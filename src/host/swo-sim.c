@@ -0,0 +1,75 @@
+/*
+Copyright (c) 2015-2016 stoyan shopov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* the simulated swo phy, used instead of swo-hw.c in host builds; trace
+ * data is fed into the trace buffer by the host harness, with
+ * swo_sim_receive()
+ *
+ * this file is included by swo.c, and must not be compiled on its own */
+
+#include "swo-sim.h"
+
+/* the number of bytes received since capture was started */
+static uint32_t sim_bytes_received;
+static bool sim_is_receiving;
+
+static void swo_phy_init(void)
+{
+}
+
+/* any nonzero baudrate is accepted */
+static uint32_t swo_phy_set_baudrate(uint32_t baudrate)
+{
+	return baudrate;
+}
+
+static void swo_phy_start(void)
+{
+	sim_bytes_received = 0;
+	sim_is_receiving = true;
+}
+
+static void swo_phy_stop(void)
+{
+	sim_is_receiving = false;
+}
+
+static uint32_t swo_phy_bytes_received(void)
+{
+	return sim_bytes_received;
+}
+
+static bool swo_phy_is_stream_error(void)
+{
+	return false;
+}
+
+/*!
+ *	\fn	void swo_sim_receive(const uint8_t * data, int count)
+ *	\brief	feeds trace data into the trace buffer, as the dma does on the probe; the data is dropped if capture is not active */
+void swo_sim_receive(const uint8_t * data, int count)
+{
+	if (!sim_is_receiving)
+		return;
+	while (count --)
+		swo_buffer[sim_bytes_received ++ & (SWO_BUFFER_SIZE - 1)] = * data ++;
+}
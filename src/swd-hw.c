@@ -21,57 +21,245 @@ THE SOFTWARE.
 */
 #include <libopencm3/stm32/gpio.h>
 
-static void swdelay(void)
+/* if nonzero, swdio and swclk are wired to the same gpio port, so that
+ * a swdio data bit and a swclk edge can be driven by a single write
+ * to the port BSRR register */
+#ifndef SWD_PINS_ON_ONE_PORT
+#define SWD_PINS_ON_ONE_PORT	0
+#endif
+
+/* if nonzero, the serial wire packet request headers and data words are
+ * shifted by the spi peripheral (see swd-spi.c), instead of by the
+ * assembly language bit loops below */
+#ifndef SWD_PHY_SPI
+#define SWD_PHY_SPI		0
+#endif
+
+#if SWD_PHY_SPI && !SWD_PINS_ON_ONE_PORT
+#error "the spi serial wire backend needs swclk and swdio on the spi2 sck and mosi pins (pb13 and pb15)"
+#endif
+
+/* the serial wire pin assignments; these are plain numbers, because the
+ * assembly language bit loops below need them as such */
+#if SWD_PINS_ON_ONE_PORT
+/* swdio is pb15, swclk is pb13 */
+#define SWDIO_GPIO_BASE		0x40010c00	/* gpiob */
+#define SWDIO_GPIO_MASK		0x8000		/* pin 15 */
+#define SWCLK_GPIO_BASE		0x40010c00	/* gpiob */
+#define SWCLK_GPIO_MASK		0x2000		/* pin 13 */
+#else
+/* swdio is pa15, swclk is pb5 */
+#define SWDIO_GPIO_BASE		0x40010800	/* gpioa */
+#define SWDIO_GPIO_MASK		0x8000		/* pin 15 */
+#define SWCLK_GPIO_BASE		0x40010c00	/* gpiob */
+#define SWCLK_GPIO_MASK		0x20		/* pin 5 */
+#endif
+/* the offset of the gpio port configuration register (CRH) holding the
+ * swdio pin mode, and the position of the pin mode field in that register */
+#define SWDIO_GPIO_CR_OFFSET	4
+#define SWDIO_GPIO_CR_SHIFT	28
+
+/* the swdio port configuration register values for driving, and for
+ * sampling swdio; these are computed by sw_phy_init() when connecting
+ * to the target, so that turning the swdio line around takes a single
+ * store to the configuration register, instead of a read-modify-write
+ * sequence; this relies on nothing else changing the configuration of
+ * the other pins in the same configuration register after connecting */
+static struct
 {
-volatile int i;
-	for (i = 0; i < nr_swd_idle_cycles; i ++);
+	uint32_t	swdio_cr_output;
+	uint32_t	swdio_cr_input;
 }
+swd_phy __attribute__((used));
 
-static inline void sw_config_swdio_output(void)
+#if SWD_PHY_SPI
+static void sw_spi_init(void);
+static uint32_t sw_spi_set_clock(uint32_t hz);
+#endif
+
+/*!
+ *	\fn	static inline void swdelay(void)
+ *	\brief	stretches a serial wire clock phase by the currently configured delay
+ *
+ *	the delay loop takes (nominally) 4 core clock cycles per iteration; when
+ *	the configured delay is zero, no delay loop is entered at all - this is
+ *	the fastest serial wire clock rate available */
+static inline void swdelay(void)
 {
-	gpio_set_mode(GPIOA, GPIO_MODE_OUTPUT_50_MHZ,
-		      GPIO_CNF_OUTPUT_PUSHPULL, GPIO15);
+uint32_t i = nr_swd_idle_cycles;
+	if (i)
+		asm volatile("1:\n"
+			"subs	%0,	%0,	#1\n"
+			"bne	1b\n"
+			: "+r" (i));
 }
 
-static inline void sw_config_swdio_input(void)
+/* the serial wire clock rate calibration table - the swclk frequency
+ * obtained for a given swdelay() loop count, with the core running
+ * at 72 MHz; entries are sorted by decreasing frequency
+ *
+ * in the assembly language bit loops below, a serial wire bit takes
+ * about 10 core clock cycles (one or two less on single port boards),
+ * plus (in the delayed versions of the bit loops) two delays of 4 cycles
+ * per delay loop iteration, plus 4 cycles of delay loop overhead - that
+ * is, 10 cycles without delay, and 14 + 8 * delay cycles otherwise; the
+ * rates below are computed from these cycle counts, rounded down, and
+ * must be recalibrated whenever the bit loops are changed */
+static const struct
 {
-	gpio_set_mode(GPIOA, GPIO_MODE_INPUT,
-		      GPIO_CNF_INPUT_PULL_UPDOWN, GPIO15);
-	gpio_set(GPIOA, GPIO15);
-	swdelay();
+	uint32_t	swclk_hz;
+	uint32_t	delay;
 }
+swclk_rate_table[] =
+{
+	{ 7200000,	0, },
+	{ 3270000,	1, },
+	{ 2400000,	2, },
+	{ 1560000,	4, },
+	{ 923000,	8, },
+	{ 507000,	16, },
+	{ 266000,	32, },
+	{ 136000,	64, },
+	{ 69300,	128, },
+	{ 34900,	256, },
+	{ 17500,	512, },
+	{ 8770,		1024, },
+	{ 2190,		4096, },
+};
 
-static inline void sw_config_swclk_output(void)
+/*!
+ *	\fn	uint32_t sw_set_clock(uint32_t hz)
+ *	\brief	sets the serial wire clock rate
+ *
+ *	selects the fastest calibrated clock rate that does not exceed the
+ *	requested one; if the requested rate is below the slowest calibrated
+ *	rate, the slowest rate is selected
+ *
+ *	\note	with the spi serial wire backend, the rate selected here is
+ *		only used for the bits that are not shifted by the spi
+ *		peripheral; the rate returned is the spi clock rate
+ *
+ *	\param	hz	the requested serial wire clock rate, in Hz
+ *	\return	the serial wire clock rate actually selected, in Hz */
+uint32_t sw_set_clock(uint32_t hz)
 {
-	gpio_set_mode(GPIOB, GPIO_MODE_OUTPUT_50_MHZ,
-		      GPIO_CNF_OUTPUT_PUSHPULL, GPIO5);
+unsigned i;
+	for (i = 0; i < sizeof swclk_rate_table / sizeof * swclk_rate_table - 1; i ++)
+		if (swclk_rate_table[i].swclk_hz <= hz)
+			break;
+	nr_swd_idle_cycles = swclk_rate_table[i].delay;
+#if SWD_PHY_SPI
+	return sw_spi_set_clock(hz);
+#else
+	return swclk_rate_table[i].swclk_hz;
+#endif
+}
+
+/*!
+ *	\fn	static void sw_phy_init(void)
+ *	\brief	configures the serial wire pins, and precomputes the swdio turnaround values
+ *
+ *	\note	on exit, both swdio and swclk are configured as outputs,
+ *		driving a high logic level */
+static void sw_phy_init(void)
+{
+uint32_t cr;
+	gpio_set(SWCLK_GPIO_BASE, SWCLK_GPIO_MASK);
+	gpio_set(SWDIO_GPIO_BASE, SWDIO_GPIO_MASK);
+	gpio_set_mode(SWCLK_GPIO_BASE, GPIO_MODE_OUTPUT_50_MHZ,
+		      GPIO_CNF_OUTPUT_PUSHPULL, SWCLK_GPIO_MASK);
+	gpio_set_mode(SWDIO_GPIO_BASE, GPIO_MODE_OUTPUT_50_MHZ,
+		      GPIO_CNF_OUTPUT_PUSHPULL, SWDIO_GPIO_MASK);
+
+	cr = MMIO32(SWDIO_GPIO_BASE + SWDIO_GPIO_CR_OFFSET) & ~((uint32_t) 0xf << SWDIO_GPIO_CR_SHIFT);
+	swd_phy.swdio_cr_output = cr | ((uint32_t) (GPIO_CNF_OUTPUT_PUSHPULL << 2 | GPIO_MODE_OUTPUT_50_MHZ) << SWDIO_GPIO_CR_SHIFT);
+	swd_phy.swdio_cr_input = cr | ((uint32_t) (GPIO_CNF_INPUT_PULL_UPDOWN << 2 | GPIO_MODE_INPUT) << SWDIO_GPIO_CR_SHIFT);
+#if SWD_PHY_SPI
+	sw_spi_init();
+#endif
+}
+
+static inline void sw_config_swdio_output(void)
+{
+	MMIO32(SWDIO_GPIO_BASE + SWDIO_GPIO_CR_OFFSET) = swd_phy.swdio_cr_output;
+}
+
+static inline void sw_config_swdio_input(void)
+{
+	/* in input mode, the output data register bit selects the pull-up */
+	GPIO_BSRR(SWDIO_GPIO_BASE) = SWDIO_GPIO_MASK;
+	MMIO32(SWDIO_GPIO_BASE + SWDIO_GPIO_CR_OFFSET) = swd_phy.swdio_cr_input;
+	swdelay();
 }
 
 static inline void swdio_hi(void)
 {
-	gpio_set(GPIOA, GPIO15);
+	GPIO_BSRR(SWDIO_GPIO_BASE) = SWDIO_GPIO_MASK;
 }
 
 static inline void swdio_low(void)
 {
-	gpio_clear(GPIOA, GPIO15);
+	GPIO_BRR(SWDIO_GPIO_BASE) = SWDIO_GPIO_MASK;
 }
 
 static inline void swclk_hi(void)
 {
-	gpio_set(GPIOB, GPIO5);
+	GPIO_BSRR(SWCLK_GPIO_BASE) = SWCLK_GPIO_MASK;
 }
 
 static inline void swclk_low(void)
 {
-	gpio_clear(GPIOB, GPIO5);
+	GPIO_BRR(SWCLK_GPIO_BASE) = SWCLK_GPIO_MASK;
 }
 
-static inline void sw_clock_out_0(void)
+static inline void sw_phy_set_pins(int pin_output, int pin_select)
+{
+	if (pin_select & SW_PIN_SWDIO)
+		(pin_output & SW_PIN_SWDIO) ? swdio_hi() : swdio_low();
+	if (pin_select & SW_PIN_SWCLK)
+		(pin_output & SW_PIN_SWCLK) ? swclk_hi() : swclk_low();
+}
+
+static inline int sw_phy_get_pins(void)
+{
+	return ((GPIO_IDR(SWCLK_GPIO_BASE) & SWCLK_GPIO_MASK) ? SW_PIN_SWCLK : 0)
+		| ((GPIO_IDR(SWDIO_GPIO_BASE) & SWDIO_GPIO_MASK) ? SW_PIN_SWDIO : 0);
+}
+
+/* the routines below pull swclk low, and at the same time drive swdio
+ * to the next data bit - the target samples swdio on the rising
+ * edge of swclk */
+#if SWD_PINS_ON_ONE_PORT
+
+static inline void swclk_low_swdio_low(void)
 {
+	GPIO_BSRR(SWCLK_GPIO_BASE) = (SWCLK_GPIO_MASK | SWDIO_GPIO_MASK) << 16;
+}
+
+static inline void swclk_low_swdio_hi(void)
+{
+	GPIO_BSRR(SWCLK_GPIO_BASE) = SWCLK_GPIO_MASK << 16 | SWDIO_GPIO_MASK;
+}
+
+#else
+
+static inline void swclk_low_swdio_low(void)
+{
+	swclk_low();
 	swdio_low();
-	swdelay();
+}
+
+static inline void swclk_low_swdio_hi(void)
+{
 	swclk_low();
+	swdio_hi();
+}
+
+#endif
+
+static inline void sw_clock_out_0(void)
+{
+	swclk_low_swdio_low();
 	swdelay();
 	swclk_hi();
 	swdelay();
@@ -79,9 +267,7 @@ static inline void sw_clock_out_0(void)
 
 static inline void sw_clock_out_1(void)
 {
-	swdio_hi();
-	swdelay();
-	swclk_low();
+	swclk_low_swdio_hi();
 	swdelay();
 	swclk_hi();
 	swdelay();
@@ -92,95 +278,28 @@ static inline bool sw_clock_data_in(void)
 bool x;
 	swclk_low();
 	swdelay();
-	x = ((gpio_get(GPIOA, GPIO15)) ? true : false);
+	x = (GPIO_IDR(SWDIO_GPIO_BASE) & SWDIO_GPIO_MASK) ? true : false;
 	swclk_hi();
 	swdelay();
 	return x;
 }
 
-
-#define SWD_DELAY \
-	asm("push	{ r0 }\n"); \
-	asm("ldr	r0,	=nr_swd_idle_cycles\n"); \
-	asm("ldr	r0,	[r0]\n"); \
-	asm("9:\n"); \
-	asm("subs	r0,	r0,	#1\n"); \
-	asm("bne	9b\n"); \
-	asm("pop	{ r0 }\n");
-
-#define LOAD_SWDIO_MASK_TO_R1	asm("mov	r1,	#1\n");
-#define LOAD_SWCLK_MASK_TO_R2	asm("mov	r2,	#2\n");
-#define TEST_SWDIO_MASK_IN_R1	asm("tst	r1,	#1\n");
-#define SWCLK_LOW		asm("str	r2,	[r3, #20]\n");
-#define SWCLK_LOW_DELAY		SWCLK_LOW SWD_DELAY
-#define SWCLK_HI		asm("str	r2,	[r3, #16]\n");
-#define SWCLK_HI_DELAY		SWCLK_HI SWD_DELAY
-
-
-#define clock_word_and_parity_in_delay clock_word_and_parity_in
-#define clock_word_and_parity_out_delay clock_word_and_parity_out
-#define clock_header_out_get_ack_delay clock_header_out_get_ack
-
-
-
-static uint32_t clock_header_out_get_ack(uint32_t w)
+/*!
+ *	\fn	static inline void sw_turnaround_to_output(void)
+ *	\brief	issues a turnaround cycle after the acknowledge phase, and takes over driving swdio
+ *
+ *	this ends a transaction that has been acknowledged with a 'wait' or a
+ *	'fault' response - the target does not expect a data phase then */
+static inline void sw_turnaround_to_output(void)
 {
-int i;
-uint32_t ack;
-
-	for (i = 1 << 7; i; i >>= 1, ((w & 1) ? sw_clock_out_1() : sw_clock_out_0()), w >>= 1);
-	/* issue a turnaround cycle */
-	sw_config_swdio_input();
-	swdelay();
 	swclk_low();
 	swdelay();
 	swclk_hi();
 	swdelay();
-	/* read the acknowledge response */
-	ack = (sw_clock_data_in() ? 1 : 0);
-	ack |= (sw_clock_data_in() ? 2 : 0);
-	return ack | (sw_clock_data_in() ? 4 : 0);
-}
-
-static uint64_t clock_word_and_parity_in(void)
-{
-uint32_t x, i;
-	/* clock word in */
-	for (x = 0, i = 1; i; x |= (sw_clock_data_in() ? i : 0), i <<= 1);
-	/* compute and verify parity */
-	i = x ^ (x >> 16);
-	i ^= i >> 8;
-	i ^= i >> 4;
-	i ^= i >> 2;
-	i ^= i >> 1;
-	i ^= (sw_clock_data_in() ? 1 : 0);
-	/* issue a turnaround cycle */
-	sw_clock_data_in();
 	sw_config_swdio_output();
-	sw_clock_out_0();
-	return x | ((uint64_t)(i & 1) << 32);
-}
-
-static void clock_word_and_parity_out(uint32_t w)
-{
-uint32_t i;
-	/* issue a turnaround cycle */
-	sw_clock_data_in();
-	sw_config_swdio_output();
-	/* clock word out */
-	for (i = 1; i; ((w & i) ? sw_clock_out_1 : sw_clock_out_0)(), i <<= 1);
-	/* compute and clock out parity */
-	w ^= w >> 16;
-	w ^= w >> 8;
-	w ^= w >> 4;
-	w ^= w >> 2;
-	w ^= w >> 1;
-	((w & 1) ? sw_clock_out_1 : sw_clock_out_0)
-		();
 }
 
 
-
 /*!
  *	\fn	static inline void sw_insert_idle_cycles(int nr_idle_cycles)
  *	\brief	inserts idle cycles on the serial wire
@@ -208,372 +327,343 @@ The host must continue to clock the interface for a number of cycles after the d
 8.3.4 Idle cycles
 Following transactions, the host must either insert idle cycles or continue immediately with the start bit of a new transaction. The host clocks the Serial Wire interface with the line LOW to insert idle cycles.
 
+ *
+ *	the idle cycles are clocked at the serial wire clock rate selected
+ *	with sw_set_clock(), just like the data bits; the spi serial wire
+ *	backend has its own version of this routine, in swd-spi.c
  *
  *	\param	nr_idle_cycles	the number of idle cycles to
  *				clock on the sw bus
  *	\return	none */
 
+#if !SWD_PHY_SPI
+
 static void sw_insert_idle_cycles(int nr_idle_cycles)
 {
 	swdio_low();
-	while (nr_idle_cycles-- > 0)
-		swclk_low(), swclk_hi();
-}
-
-#if 0
-
-static void clock_word_and_parity_out(uint32_t w)
-{
-	asm("push	{ r4, lr }\n");
-	LOAD_SWDIO_MASK_TO_R1
-	LOAD_SWCLK_MASK_TO_R2
-	/* load gpiob-base address */
-	asm("ldr	r3,	=0x40010c00\n");
-	/* issue a turnaround cycle */
-	SWCLK_LOW
-	SWCLK_HI
-
-	/* configure swdio as output */
-	asm("ldr	r4,	[r3, #0]\n");
-	asm("and	r4,	#0xfffffff0\n");
-	asm("orr	r4,	#3\n");
-	asm("str	r4,	[r3, #0]\n");
-
-
-	asm("mov	r4,	#1\n");
-
-	asm("1:\n");
-	SWCLK_LOW
-	asm("tst	r0,	r4\n");
-	asm("ite	ne\n");
-	asm("strne	r1,	[r3, #16]\n");
-	asm("streq	r1,	[r3, #20]\n");
-	SWCLK_HI
-	asm("lsls	r4,	r4,	#1\n");
-	asm("bne	1b\n");
-
-	/* compute parity in r0 */
-	asm("eor	r0, r0, r0, lsr #16\n");
-	asm("eor	r0, r0, r0, lsr #8\n");
-	asm("eor	r0, r0, r0, lsr #4\n");
-	asm("eor	r0, r0, r0, lsr #2\n");
-	asm("eor	r0, r0, r0, lsr #1\n");
-
-	/* shift parity out */
-	SWCLK_LOW
-	asm("tst	r0,	#1\n");
-	asm("ite	ne\n");
-	asm("strne	r1,	[r3, #16]\n");
-	asm("streq	r1,	[r3, #20]\n");
-	SWCLK_HI
-
-	asm("pop	{ r4, pc }\n");
-
-}
-
-
-static uint32_t clock_header_out_get_ack(uint32_t w)
-{
-	asm("push	{ r4, lr }\n");
-	/* load counter */
-	asm("mov	r4,	#(1 << (32 - 8))\n");
-	LOAD_SWDIO_MASK_TO_R1
-	LOAD_SWCLK_MASK_TO_R2
-	/* load gpiob-base address */
-	asm("ldr	r3,	=0x40010c00\n");
-
-	asm("1:\n");
-	SWCLK_LOW
-	asm("lsrs	r0,	#1\n");
-	asm("ite	cs\n");
-	asm("strcs	r1,	[r3, #16]\n");
-	asm("strcc	r1,	[r3, #20]\n");
-	SWCLK_HI
-	asm("lsls	r4,	r4,	#1\n");
-	asm("bne	1b\n");
-
-	/* configure swdio as input */
-	asm("ldr	r0,	[r3, #0]\n");
-	asm("and	r0,	#0xfffffff0\n");
-	asm("orr	r0,	#8\n");
-	asm("str	r0,	[r3, #0]\n");
-	//asm("str	r1,	[r3, #16]\n");
-
-	/* issue a turnaround cycle */
-	SWCLK_LOW
-	asm("mov	r0,	#0\n");
-	SWCLK_HI
-
-	/* read the 3-bit ack value */
-	SWCLK_LOW
-	asm("ldr	r1,	[r3, #8]\n");
-	TEST_SWDIO_MASK_IN_R1
-	asm("it		ne\n");
-	asm("orrne	r0, r0, #1\n");
-	SWCLK_HI
-
-	SWCLK_LOW
-	asm("ldr	r1,	[r3, #8]\n");
-	TEST_SWDIO_MASK_IN_R1
-	asm("it		ne\n");
-	asm("orrne	r0, r0, #2\n");
-	SWCLK_HI
-
-
-	SWCLK_LOW
-	asm("ldr	r1,	[r3, #8]\n");
-	TEST_SWDIO_MASK_IN_R1
-	asm("it		ne\n");
-	asm("orrne	r0, r0, #4\n");
-	SWCLK_HI
-
-	asm("pop	{ r4, pc }\n");
-}
-
-
-static uint64_t clock_word_and_parity_in(void)
-{
-	asm("push	{ r4, lr }\n");
-	asm("mov	r0,	#0\n");
-	LOAD_SWCLK_MASK_TO_R2
-	asm("mov	r4,	#1\n");
-	/* load gpiob-base address */
-	asm("ldr	r3,	=0x40010c00\n");
-
-	asm("1:\n");
-	SWCLK_LOW
-	asm("ldr	r1,	[r3, #8]\n");
-	TEST_SWDIO_MASK_IN_R1
-	asm("it		ne\n");
-	asm("orrne	r0, r0, r4\n");
-	SWCLK_HI
-	asm("lsls	r4,	r4,	#1\n");
-	asm("bne	1b\n");
-	/* compute parity in r1 */
-	asm("eor	r1, r0, r0, lsr #16\n");
-	asm("eor	r1, r1, r1, lsr #8\n");
-	asm("eor	r1, r1, r1, lsr #4\n");
-	asm("eor	r1, r1, r1, lsr #2\n");
-	asm("eor	r1, r1, r1, lsr #1\n");
-	asm("and	r1, r1, #1\n");
-
-	/* read parity bit */
-
-	SWCLK_LOW
-	asm("ldr	r4,	[r3, #8]\n");
-	asm("tst	r4,	#1\n");
-	asm("it		ne\n");
-	asm("eorne	r1, r1, #1\n");
-	SWCLK_HI
-
-	/* arm document 'ADIv5.1 supplement':
-	DSA09-PRDC-008772-1-0_ARM_debug_interface_v5_supplement
-	 * section 8.2, mandates:
-
-	8.2 Clocking
-	The Serial Wire interface clock can be asynchronous to any system clock, including the debug logic clock. The Serial Wire interface clock can be stopped when the debug port is idle.
-	The host must continue to clock the interface for a number of cycles after the data phase of transactions. This ensures that the transaction can be clocked through the Serial Wire interface. This means that after the data phase of transactions the host must do one of the following:
-	 immediately start a new transaction
-	 continue to clock the Serial Wire interface until the host starts a new transaction, inserting idle cycles
-	 after clocking out the data parity bit, continue to clock the Serial Wire interface inserting idle cycles until it has clocked out at least 8 more clock rising edges, before stopping the clock.
-	See also Idle cycles on page 43.
-
-	8.3.3 Line turn-round
-	To avoid contention, a turnaround period is required when the device driving the wire changes.
-
-	8.3.4 Idle cycles
-	Following transactions, the host must either insert idle cycles or continue immediately with the start bit of a new transaction. The host clocks the Serial Wire interface with the line LOW to insert idle cycles.
-
-	* so, insert a turnaround cycle */
-	SWCLK_LOW
-	SWCLK_HI
-
-	/* configure swdio as output */
-	asm("ldr	r2,	[r3, #0]\n");
-	asm("and	r2,	#0xfffffff0\n");
-	asm("orr	r2,	#3\n");
-	asm("str	r2,	[r3, #0]\n");
-
-	asm("pop	{ r4, pc }\n");
+	if (nr_swd_idle_cycles)
+		while (nr_idle_cycles-- > 0)
+			sw_clock_out_0();
+	else
+		while (nr_idle_cycles-- > 0)
+			swclk_low(), swclk_hi();
+}
+
+/* the bit loops below are the hottest code in the firmware, so they
+ * are written in assembly language; the register usage is:
+ *	r1	- the swdio gpio pin mask
+ *	r2	- the swclk gpio pin mask
+ *	r3	- the swclk gpio port base address
+ *	r4	- the swdio gpio port base address
+ *	r5	- the swdelay() loop count (in the delayed versions only)
+ *	r6	- the precomputed swdio configuration register value for output mode
+ *	r7	- the precomputed swdio configuration register value for input mode
+ *	r8	- (single port boards only) the BSRR value for swclk low, swdio high
+ *	r9	- (single port boards only) the BSRR value for swclk low, swdio low
+ *	r12	- scratch
+ *	lr	- the bit counter
+ * the offsets used for accessing the gpio port registers are:
+ *	0/4	- CRL/CRH, 8 - IDR, 16 - BSRR, 20 - BRR */
+#define STRINGIFY_(x)	#x
+#define STRINGIFY(x)	STRINGIFY_(x)
+
+#if SWD_PINS_ON_ONE_PORT
+#define LOAD_BSRR_VALUES \
+	"movw	r8,	#:lower16:" STRINGIFY((SWCLK_GPIO_MASK << 16 | SWDIO_GPIO_MASK)) "\n" \
+	"movt	r8,	#:upper16:" STRINGIFY((SWCLK_GPIO_MASK << 16 | SWDIO_GPIO_MASK)) "\n" \
+	"movw	r9,	#:lower16:" STRINGIFY((SWCLK_GPIO_MASK | SWDIO_GPIO_MASK) << 16) "\n" \
+	"movt	r9,	#:upper16:" STRINGIFY((SWCLK_GPIO_MASK | SWDIO_GPIO_MASK) << 16) "\n"
+/* pull swclk low, and drive swdio high if condition 'cc' holds, or low
+ * otherwise - with a single store to the port BSRR register; 'ncc' must
+ * be the inverse condition of 'cc' */
+#define SWCLK_LOW_SWDIO_OUT(cc, ncc) \
+	"ite	" cc "\n" \
+	"str" cc "	r8,	[r3, #16]\n" \
+	"str" ncc "	r9,	[r3, #16]\n"
+#else
+#define LOAD_BSRR_VALUES
+#define SWCLK_LOW_SWDIO_OUT(cc, ncc) \
+	SWCLK_LOW \
+	"ite	" cc "\n" \
+	"str" cc "	r1,	[r4, #16]\n" \
+	"str" ncc "	r1,	[r4, #20]\n"
+#endif
+
+#define LOAD_PIN_REGISTERS \
+	"mov	r1,	#" STRINGIFY(SWDIO_GPIO_MASK) "\n" \
+	"mov	r2,	#" STRINGIFY(SWCLK_GPIO_MASK) "\n" \
+	"movw	r3,	#:lower16:" STRINGIFY(SWCLK_GPIO_BASE) "\n" \
+	"movt	r3,	#:upper16:" STRINGIFY(SWCLK_GPIO_BASE) "\n" \
+	"movw	r4,	#:lower16:" STRINGIFY(SWDIO_GPIO_BASE) "\n" \
+	"movt	r4,	#:upper16:" STRINGIFY(SWDIO_GPIO_BASE) "\n" \
+	"movw	r12,	#:lower16:swd_phy\n" \
+	"movt	r12,	#:upper16:swd_phy\n" \
+	"ldrd	r6,	r7,	[r12]\n" \
+	LOAD_BSRR_VALUES
+#define LOAD_DELAY_TO_R5 \
+	"movw	r5,	#:lower16:nr_swd_idle_cycles\n" \
+	"movt	r5,	#:upper16:nr_swd_idle_cycles\n" \
+	"ldr	r5,	[r5]\n"
+/* same as swdelay(), the loop count must be non-zero */
+#define SWD_DELAY \
+	"mov	r12,	r5\n" \
+	"9:\n" \
+	"subs	r12,	r12,	#1\n" \
+	"bne	9b\n"
+#define SWCLK_LOW		"str	r2,	[r3, #20]\n"
+#define SWCLK_HI		"str	r2,	[r3, #16]\n"
+#define PUSH_REGISTERS		"push	{ r4, r5, r6, r7, r8, r9, lr }\n"
+#define POP_REGISTERS		"pop	{ r4, r5, r6, r7, r8, r9, pc }\n"
+#define SWDIO_CONFIG_OUTPUT \
+	"str	r6,	[r4, #" STRINGIFY(SWDIO_GPIO_CR_OFFSET) "]\n"
+/* configure swdio as an input with a pull-up - the pull-up is selected
+ * by the swdio output data register bit, which is already set here, as
+ * this is only done right after clocking out the (always one) park bit
+ * of a packet request header */
+#define SWDIO_CONFIG_INPUT \
+	"str	r7,	[r4, #" STRINGIFY(SWDIO_GPIO_CR_OFFSET) "]\n"
+/* sample swdio while swclk is low, and if it is high, set the bits in 'mask' in r0 */
+#define SAMPLE_SWDIO_TO_R0(mask, DELAY) \
+	SWCLK_LOW \
+	DELAY \
+	"ldr	r12,	[r4, #8]\n" \
+	"tst	r12,	r1\n" \
+	"it	ne\n" \
+	"orrne	r0,	r0,	" mask "\n" \
+	SWCLK_HI \
+	DELAY
+
+#define CLOCK_HEADER_OUT_GET_ACK(DELAY) \
+	LOAD_PIN_REGISTERS \
+	/* clock the 8 header bits out, lsb first */ \
+	"mov	lr,	#(1 << (32 - 8))\n" \
+	"1:\n" \
+	"lsrs	r0,	r0,	#1\n" \
+	SWCLK_LOW_SWDIO_OUT("cs", "cc") \
+	DELAY \
+	SWCLK_HI \
+	DELAY \
+	"lsls	lr,	lr,	#1\n" \
+	"bne	1b\n" \
+	SWDIO_CONFIG_INPUT \
+	/* issue a turnaround cycle */ \
+	SWCLK_LOW \
+	DELAY \
+	SWCLK_HI \
+	DELAY \
+	/* read the 3-bit ack value */ \
+	"mov	r0,	#0\n" \
+	SAMPLE_SWDIO_TO_R0("#1", DELAY) \
+	SAMPLE_SWDIO_TO_R0("#2", DELAY) \
+	SAMPLE_SWDIO_TO_R0("#4", DELAY)
+
+#define CLOCK_WORD_AND_PARITY_IN(DELAY) \
+	LOAD_PIN_REGISTERS \
+	/* clock the 32 data bits in, lsb first */ \
+	"mov	r0,	#0\n" \
+	"mov	lr,	#1\n" \
+	"1:\n" \
+	SAMPLE_SWDIO_TO_R0("lr", DELAY) \
+	"lsls	lr,	lr,	#1\n" \
+	"bne	1b\n" \
+	/* compute the parity of the data word in lr */ \
+	"eor	lr,	r0,	r0,	lsr #16\n" \
+	"eor	lr,	lr,	lr,	lsr #8\n" \
+	"eor	lr,	lr,	lr,	lsr #4\n" \
+	"eor	lr,	lr,	lr,	lsr #2\n" \
+	"eor	lr,	lr,	lr,	lsr #1\n" \
+	/* read the parity bit, and check it against the computed parity */ \
+	SWCLK_LOW \
+	DELAY \
+	"ldr	r12,	[r4, #8]\n" \
+	"tst	r12,	r1\n" \
+	"it	ne\n" \
+	"eorne	lr,	lr,	#1\n" \
+	SWCLK_HI \
+	DELAY \
+	/* issue a turnaround cycle - see sw_insert_idle_cycles() for details */ \
+	SWCLK_LOW \
+	DELAY \
+	SWCLK_HI \
+	DELAY \
+	SWDIO_CONFIG_OUTPUT \
+	/* return the parity error flag in the upper word of the result */ \
+	"and	r1,	lr,	#1\n"
+
+#define CLOCK_WORD_AND_PARITY_OUT(DELAY) \
+	LOAD_PIN_REGISTERS \
+	/* issue a turnaround cycle */ \
+	SWCLK_LOW \
+	DELAY \
+	SWCLK_HI \
+	DELAY \
+	SWDIO_CONFIG_OUTPUT \
+	/* clock the 32 data bits out, lsb first */ \
+	"mov	lr,	#1\n" \
+	"1:\n" \
+	"tst	r0,	lr\n" \
+	SWCLK_LOW_SWDIO_OUT("ne", "eq") \
+	DELAY \
+	SWCLK_HI \
+	DELAY \
+	"lsls	lr,	lr,	#1\n" \
+	"bne	1b\n" \
+	/* compute the parity in r0 */ \
+	"eor	r0,	r0,	r0,	lsr #16\n" \
+	"eor	r0,	r0,	r0,	lsr #8\n" \
+	"eor	r0,	r0,	r0,	lsr #4\n" \
+	"eor	r0,	r0,	r0,	lsr #2\n" \
+	"eor	r0,	r0,	r0,	lsr #1\n" \
+	/* clock the parity bit out */ \
+	"tst	r0,	#1\n" \
+	SWCLK_LOW_SWDIO_OUT("ne", "eq") \
+	DELAY \
+	SWCLK_HI \
+	DELAY
+
+/* 'bit_count' is passed in r1, and must be in the range 1..32; the bit
+ * counter is set up so that it overflows after 'bit_count' shifts */
+#define CLOCK_BITS_OUT(DELAY) \
+	"rsb	r12,	r1,	#32\n" \
+	"mov	lr,	#1\n" \
+	"lsl	lr,	lr,	r12\n" \
+	LOAD_PIN_REGISTERS \
+	/* clock the bits out, lsb first */ \
+	"1:\n" \
+	"lsrs	r0,	r0,	#1\n" \
+	SWCLK_LOW_SWDIO_OUT("cs", "cc") \
+	DELAY \
+	SWCLK_HI \
+	DELAY \
+	"lsls	lr,	lr,	#1\n" \
+	"bne	1b\n"
+
+/*!
+ *	\fn	static uint32_t clock_header_out_get_ack(uint32_t w)
+ *	\brief	clocks out a serial wire packet request header, and clocks in the target acknowledge
+ *
+ *	\note	on exit, swdio is configured as an input
+ *
+ *	\param	w	the 8 bit packet request header
+ *	\return	the 3 bit acknowledge value received from the target */
+static uint32_t __attribute__((naked, noinline)) clock_header_out_get_ack(uint32_t w)
+{
+	asm(PUSH_REGISTERS
+		CLOCK_HEADER_OUT_GET_ACK("")
+		POP_REGISTERS);
+}
+
+/*!
+ *	\fn	static uint64_t clock_word_and_parity_in(void)
+ *	\brief	clocks in a serial wire data word and its parity bit, then issues a turnaround cycle
+ *
+ *	\note	on entry, swdio must be configured as an input; on exit,
+ *		swdio is configured as an output
+ *
+ *	\return	the data word in the low 32 bits; bit 32 is set if a parity error was detected */
+static uint64_t __attribute__((naked, noinline)) clock_word_and_parity_in(void)
+{
+	asm(PUSH_REGISTERS
+		CLOCK_WORD_AND_PARITY_IN("")
+		POP_REGISTERS);
+}
+
+/*!
+ *	\fn	static void clock_word_and_parity_out(uint32_t w)
+ *	\brief	issues a turnaround cycle, then clocks out a serial wire data word and its parity bit
+ *
+ *	\note	on entry, swdio must be configured as an input; on exit,
+ *		swdio is configured as an output
+ *
+ *	\param	w	the data word to clock out */
+static void __attribute__((naked, noinline)) clock_word_and_parity_out(uint32_t w)
+{
+	asm(PUSH_REGISTERS
+		CLOCK_WORD_AND_PARITY_OUT("")
+		POP_REGISTERS);
 }
 
+/*!
+ *	\fn	static void clock_bits_out(uint32_t w, int bit_count)
+ *	\brief	clocks out up to 32 bits on swdio, least significant bit first
+ *
+ *	\note	swdio must be configured as an output on entry, and
+ *		remains configured as an output on exit
+ *
+ *	\param	w		the bits to clock out
+ *	\param	bit_count	the number of bits in 'w' to clock out, 1..32 */
+static void __attribute__((naked, noinline)) clock_bits_out(uint32_t w, int bit_count)
+{
+	asm(PUSH_REGISTERS
+		CLOCK_BITS_OUT("")
+		POP_REGISTERS);
+}
 
 /* versions of the routines above - in case there is a non-zero swd communication delay requested */
 
+static uint32_t __attribute__((naked, noinline)) clock_header_out_get_ack_delay(uint32_t w)
+{
+	asm(PUSH_REGISTERS
+		LOAD_DELAY_TO_R5
+		CLOCK_HEADER_OUT_GET_ACK(SWD_DELAY)
+		POP_REGISTERS);
+}
 
-static void clock_word_and_parity_out_delay(uint32_t w)
-{
-	asm("push	{ r4, lr }\n");
-	LOAD_SWDIO_MASK_TO_R1
-	LOAD_SWCLK_MASK_TO_R2
-	/* load gpiob-base address */
-	asm("ldr	r3,	=0x40010c00\n");
-	/* issue a turnaround cycle */
-	SWCLK_LOW_DELAY
-	SWCLK_HI_DELAY
-
-	/* configure swdio as output */
-	asm("ldr	r4,	[r3, #0]\n");
-	asm("and	r4,	#0xfffffff0\n");
-	asm("orr	r4,	#3\n");
-	asm("str	r4,	[r3, #0]\n");
-
-
-	asm("mov	r4,	#1\n");
-
-	asm("1:\n");
-	SWCLK_LOW_DELAY
-	asm("tst	r0,	r4\n");
-	asm("ite	ne\n");
-	asm("strne	r1,	[r3, #16]\n");
-	asm("streq	r1,	[r3, #20]\n");
-	SWCLK_HI_DELAY
-	asm("lsls	r4,	r4,	#1\n");
-	asm("bne	1b\n");
-
-	/* compute parity in r0 */
-	asm("eor	r0, r0, r0, lsr #16\n");
-	asm("eor	r0, r0, r0, lsr #8\n");
-	asm("eor	r0, r0, r0, lsr #4\n");
-	asm("eor	r0, r0, r0, lsr #2\n");
-	asm("eor	r0, r0, r0, lsr #1\n");
-
-	/* shift parity out */
-	SWCLK_LOW_DELAY
-	asm("tst	r0,	#1\n");
-	asm("ite	ne\n");
-	asm("strne	r1,	[r3, #16]\n");
-	asm("streq	r1,	[r3, #20]\n");
-	SWCLK_HI_DELAY
-
-	asm("pop	{ r4, pc }\n");
-
-}
-
-
-static uint32_t clock_header_out_get_ack_delay(uint32_t w)
-{
-	asm("push	{ r4, lr }\n");
-	/* load counter */
-	asm("mov	r4,	#(1 << (32 - 8))\n");
-	LOAD_SWDIO_MASK_TO_R1
-	LOAD_SWCLK_MASK_TO_R2
-	/* load gpiob-base address */
-	asm("ldr	r3,	=0x40010c00\n");
-
-	asm("1:\n");
-	SWCLK_LOW_DELAY
-	asm("lsrs	r0,	#1\n");
-	asm("ite	cs\n");
-	asm("strcs	r1,	[r3, #16]\n");
-	asm("strcc	r1,	[r3, #20]\n");
-	SWCLK_HI_DELAY
-	asm("lsls	r4,	r4,	#1\n");
-	asm("bne	1b\n");
-
-	/* configure swdio as input */
-	asm("ldr	r0,	[r3, #0]\n");
-	asm("and	r0,	#0xfffffff0\n");
-	asm("orr	r0,	#8\n");
-	asm("str	r0,	[r3, #0]\n");
-	//asm("str	r1,	[r3, #16]\n");
-
-	/* issue a turnaround cycle */
-	SWCLK_LOW_DELAY
-	asm("mov	r0,	#0\n");
-	SWCLK_HI_DELAY
-
-	/* read the 3-bit ack value */
-	SWCLK_LOW_DELAY
-	asm("ldr	r1,	[r3, #8]\n");
-	TEST_SWDIO_MASK_IN_R1
-	asm("it		ne\n");
-	asm("orrne	r0, r0, #1\n");
-	SWCLK_HI_DELAY
-
-	SWCLK_LOW_DELAY
-	asm("ldr	r1,	[r3, #8]\n");
-	TEST_SWDIO_MASK_IN_R1
-	asm("it		ne\n");
-	asm("orrne	r0, r0, #2\n");
-	SWCLK_HI_DELAY
-
-
-	SWCLK_LOW_DELAY
-	asm("ldr	r1,	[r3, #8]\n");
-	TEST_SWDIO_MASK_IN_R1
-	asm("it		ne\n");
-	asm("orrne	r0, r0, #4\n");
-	SWCLK_HI_DELAY
-
-	asm("pop	{ r4, pc }\n");
-}
-
-
-static uint64_t clock_word_and_parity_in_delay(void)
-{
-	asm("push	{ r4, lr }\n");
-	asm("mov	r0,	#0\n");
-	LOAD_SWCLK_MASK_TO_R2
-	asm("mov	r4,	#1\n");
-	/* load gpiob-base address */
-	asm("ldr	r3,	=0x40010c00\n");
-
-	asm("1:\n");
-	SWCLK_LOW_DELAY
-	asm("ldr	r1,	[r3, #8]\n");
-	TEST_SWDIO_MASK_IN_R1
-	asm("it		ne\n");
-	asm("orrne	r0, r0, r4\n");
-	SWCLK_HI_DELAY
-	asm("lsls	r4,	r4,	#1\n");
-	asm("bne	1b\n");
-	/* compute parity in r1 */
-	asm("eor	r1, r0, r0, lsr #16\n");
-	asm("eor	r1, r1, r1, lsr #8\n");
-	asm("eor	r1, r1, r1, lsr #4\n");
-	asm("eor	r1, r1, r1, lsr #2\n");
-	asm("eor	r1, r1, r1, lsr #1\n");
-	asm("and	r1, r1, #1\n");
-
-	/* read parity bit */
-
-	SWCLK_LOW_DELAY
-	asm("ldr	r4,	[r3, #8]\n");
-	asm("tst	r4,	#1\n");
-	asm("it		ne\n");
-	asm("eorne	r1, r1, #1\n");
-	SWCLK_HI_DELAY
-
-	/* arm document 'ADIv5.1 supplement':
-	DSA09-PRDC-008772-1-0_ARM_debug_interface_v5_supplement
-	 * section 8.2, mandates:
-
-	8.2 Clocking
-	The Serial Wire interface clock can be asynchronous to any system clock, including the debug logic clock. The Serial Wire interface clock can be stopped when the debug port is idle.
-	The host must continue to clock the interface for a number of cycles after the data phase of transactions. This ensures that the transaction can be clocked through the Serial Wire interface. This means that after the data phase of transactions the host must do one of the following:
-	 immediately start a new transaction
-	 continue to clock the Serial Wire interface until the host starts a new transaction, inserting idle cycles
-	 after clocking out the data parity bit, continue to clock the Serial Wire interface inserting idle cycles until it has clocked out at least 8 more clock rising edges, before stopping the clock.
-	See also Idle cycles on page 43.
-
-	8.3.3 Line turn-round
-	To avoid contention, a turnaround period is required when the device driving the wire changes.
-
-	8.3.4 Idle cycles
-	Following transactions, the host must either insert idle cycles or continue immediately with the start bit of a new transaction. The host clocks the Serial Wire interface with the line LOW to insert idle cycles.
-
-	* so, insert a turnaround cycle */
-	SWCLK_LOW_DELAY
-	SWCLK_HI_DELAY
-
-	/* configure swdio as output */
-	asm("ldr	r2,	[r3, #0]\n");
-	asm("and	r2,	#0xfffffff0\n");
-	asm("orr	r2,	#3\n");
-	asm("str	r2,	[r3, #0]\n");
-
-	asm("pop	{ r4, pc }\n");
+static uint64_t __attribute__((naked, noinline)) clock_word_and_parity_in_delay(void)
+{
+	asm(PUSH_REGISTERS
+		LOAD_DELAY_TO_R5
+		CLOCK_WORD_AND_PARITY_IN(SWD_DELAY)
+		POP_REGISTERS);
 }
 
-#endif
+static void __attribute__((naked, noinline)) clock_word_and_parity_out_delay(uint32_t w)
+{
+	asm(PUSH_REGISTERS
+		LOAD_DELAY_TO_R5
+		CLOCK_WORD_AND_PARITY_OUT(SWD_DELAY)
+		POP_REGISTERS);
+}
+
+static void __attribute__((naked, noinline)) clock_bits_out_delay(uint32_t w, int bit_count)
+{
+	asm(PUSH_REGISTERS
+		LOAD_DELAY_TO_R5
+		CLOCK_BITS_OUT(SWD_DELAY)
+		POP_REGISTERS);
+}
+
+/* the routines below select the bit loops with, or without, the clock
+ * phase delays, depending on the currently configured serial wire clock rate */
+
+static inline uint32_t sw_clock_header_out_get_ack(uint32_t w)
+{
+	return nr_swd_idle_cycles ? clock_header_out_get_ack_delay(w) : clock_header_out_get_ack(w);
+}
+
+static inline uint64_t sw_clock_word_and_parity_in(void)
+{
+	return nr_swd_idle_cycles ? clock_word_and_parity_in_delay() : clock_word_and_parity_in();
+}
+
+static inline void sw_clock_word_and_parity_out(uint32_t w)
+{
+	if (nr_swd_idle_cycles)
+		clock_word_and_parity_out_delay(w);
+	else
+		clock_word_and_parity_out(w);
+}
+
+static inline void sw_clock_bits_out(uint32_t w, int bit_count)
+{
+	if (nr_swd_idle_cycles)
+		clock_bits_out_delay(w, bit_count);
+	else
+		clock_bits_out(w, bit_count);
+}
+
+#else
+
+#include "swd-spi.c"
+
+#endif /* SWD_PHY_SPI */
@@ -0,0 +1,272 @@
+/*
+Copyright (c) 2015-2016 stoyan shopov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* the spi serial wire backend - the 8 bit packet request headers, and
+ * the 32 bit data words are shifted by the spi2 peripheral, while the
+ * turnaround, acknowledge and parity bits are bit-banged with the
+ * routines in swd-hw.c
+ *
+ * swclk is wired to the spi2 sck pin (pb13), swdio is wired to the
+ * spi2 mosi pin (pb15), and the spi2 miso pin (pb14) must be
+ * connected to swdio as well; when the target drives swdio, the mosi
+ * pin is configured as an input, so that the spi peripheral only
+ * samples swdio on the miso pin - the spi peripheral is run in
+ * full duplex mode, because in this mode it generates exactly 8 clock
+ * pulses per frame; the miso pin is left in its reset state (a
+ * floating input) at all times
+ *
+ * the spi clock idles high (as swclk does), and the spi data is
+ * output on the falling, and sampled on the rising swclk edge,
+ * least significant bit first - this matches the serial wire
+ * protocol bit order and timing; the target changes swdio on the
+ * rising swclk edge, so target reads rely on its output delay,
+ * just like most spi based serial wire probes do
+ *
+ * this file is included by swd-hw.c, and must not be compiled on its own */
+
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/spi.h>
+
+#define SWD_SPI			SPI2
+/* the positions of the swclk (pb13) pin mode field in the gpiob CRH
+ * register; the swdio (pb15) field is at SWDIO_GPIO_CR_SHIFT */
+#define SWCLK_GPIO_CR_SHIFT	20
+
+/* the gpiob CRH register values for the spi data phases - these are
+ * computed by sw_spi_init() from the values in 'swd_phy', when connecting
+ * to the target */
+static struct
+{
+	/* swclk and swdio are both driven by the spi peripheral */
+	uint32_t	cr_spi_write;
+	/* swclk is driven by the spi peripheral, swdio is an input */
+	uint32_t	cr_spi_read;
+}
+swd_spi;
+
+/* the spi2 clock rates available, with the spi2 peripheral (on the apb1
+ * bus) clocked at 36 MHz; entries are sorted by decreasing frequency */
+static const struct
+{
+	uint32_t	swclk_hz;
+	uint8_t		prescaler;
+}
+spi_rate_table[] =
+{
+	{ 9000000,	SPI_CR1_BR_FPCLK_DIV_4, },
+	{ 4500000,	SPI_CR1_BR_FPCLK_DIV_8, },
+	{ 2250000,	SPI_CR1_BR_FPCLK_DIV_16, },
+	{ 1125000,	SPI_CR1_BR_FPCLK_DIV_32, },
+	{ 562500,	SPI_CR1_BR_FPCLK_DIV_64, },
+	{ 281250,	SPI_CR1_BR_FPCLK_DIV_128, },
+	{ 140625,	SPI_CR1_BR_FPCLK_DIV_256, },
+};
+
+/*!
+ *	\fn	static void sw_spi_init(void)
+ *	\brief	initializes the spi peripheral, and precomputes the pin configurations for the spi data phases
+ *
+ *	\note	this is called by sw_phy_init(), after the serial wire
+ *		pins have been configured for bit-banging */
+static void sw_spi_init(void)
+{
+uint32_t cr;
+	rcc_periph_clock_enable(RCC_SPI2);
+	spi_reset(SWD_SPI);
+	spi_init_master(SWD_SPI, SPI_CR1_BAUDRATE_FPCLK_DIV_8, SPI_CR1_CPOL_CLK_TO_1_WHEN_IDLE,
+			SPI_CR1_CPHA_CLK_TRANSITION_2, SPI_CR1_DFF_8BIT, SPI_CR1_LSBFIRST);
+	spi_enable_software_slave_management(SWD_SPI);
+	spi_set_nss_high(SWD_SPI);
+	spi_enable(SWD_SPI);
+
+	cr = swd_phy.swdio_cr_output & ~((uint32_t) 0xf << SWCLK_GPIO_CR_SHIFT | (uint32_t) 0xf << SWDIO_GPIO_CR_SHIFT);
+	swd_spi.cr_spi_write = cr | (uint32_t) (GPIO_CNF_OUTPUT_ALTFN_PUSHPULL << 2 | GPIO_MODE_OUTPUT_50_MHZ) << SWCLK_GPIO_CR_SHIFT
+		| (uint32_t) (GPIO_CNF_OUTPUT_ALTFN_PUSHPULL << 2 | GPIO_MODE_OUTPUT_50_MHZ) << SWDIO_GPIO_CR_SHIFT;
+	cr = swd_phy.swdio_cr_input & ~((uint32_t) 0xf << SWCLK_GPIO_CR_SHIFT);
+	swd_spi.cr_spi_read = cr | (uint32_t) (GPIO_CNF_OUTPUT_ALTFN_PUSHPULL << 2 | GPIO_MODE_OUTPUT_50_MHZ) << SWCLK_GPIO_CR_SHIFT;
+}
+
+/*!
+ *	\fn	static uint32_t sw_spi_set_clock(uint32_t hz)
+ *	\brief	sets the spi clock rate used for the serial wire data phases
+ *
+ *	\param	hz	the requested serial wire clock rate, in Hz
+ *	\return	the spi clock rate actually selected, in Hz */
+static uint32_t sw_spi_set_clock(uint32_t hz)
+{
+unsigned i;
+	for (i = 0; i < sizeof spi_rate_table / sizeof * spi_rate_table - 1; i ++)
+		if (spi_rate_table[i].swclk_hz <= hz)
+			break;
+	/* the spi clock rate can only be changed while the peripheral is disabled */
+	spi_disable(SWD_SPI);
+	spi_set_baudrate_prescaler(SWD_SPI, spi_rate_table[i].prescaler);
+	spi_enable(SWD_SPI);
+	return spi_rate_table[i].swclk_hz;
+}
+
+/*!
+ *	\fn	static inline void sw_spi_write(uint32_t w, int nr_bytes)
+ *	\brief	shifts data out on the spi peripheral, least significant byte first
+ *
+ *	the next frame is written as soon as the transmit buffer is empty, so that
+ *	there are no gaps between the frames; the data received meanwhile is
+ *	discarded
+ *
+ *	\param	w		the data to shift out
+ *	\param	nr_bytes	the number of bytes in 'w' to shift out */
+static inline void sw_spi_write(uint32_t w, int nr_bytes)
+{
+	while (nr_bytes --)
+	{
+		while (!(SPI_SR(SWD_SPI) & SPI_SR_TXE))
+			;
+		SPI_DR(SWD_SPI) = w & 0xff;
+		w >>= 8;
+	}
+	while (!(SPI_SR(SWD_SPI) & SPI_SR_TXE))
+		;
+	while (SPI_SR(SWD_SPI) & SPI_SR_BSY)
+		;
+	/* discard the received data, and clear the overrun flag */
+	(void) SPI_DR(SWD_SPI);
+	(void) SPI_SR(SWD_SPI);
+}
+
+/*!
+ *	\fn	static inline uint32_t sw_spi_read_word(void)
+ *	\brief	shifts a 32 bit word in on the spi peripheral, least significant byte first
+ *
+ *	\return	the word read */
+static inline uint32_t sw_spi_read_word(void)
+{
+uint32_t x;
+int i;
+	x = 0;
+	for (i = 0; i < 32; i += 8)
+	{
+		SPI_DR(SWD_SPI) = 0xff;
+		while (!(SPI_SR(SWD_SPI) & SPI_SR_RXNE))
+			;
+		x |= (SPI_DR(SWD_SPI) & 0xff) << i;
+	}
+	return x;
+}
+
+/*!
+ *	\fn	static void sw_insert_idle_cycles(int nr_idle_cycles)
+ *	\brief	inserts idle cycles on the serial wire
+ *
+ *	this is the spi backend version of the routine in swd-hw.c - see
+ *	there for details; whole bytes of idle cycles are shifted out by the
+ *	spi peripheral, at the spi clock rate, and the idle cycles left over
+ *	are bit-banged, with the swdelay() delays of the clock rate selected
+ *
+ *	\param	nr_idle_cycles	the number of idle cycles to
+ *				clock on the sw bus */
+static void sw_insert_idle_cycles(int nr_idle_cycles)
+{
+	swdio_low();
+	if (nr_idle_cycles >= 8)
+	{
+		GPIO_CRH(SWCLK_GPIO_BASE) = swd_spi.cr_spi_write;
+		sw_spi_write(0, nr_idle_cycles >> 3);
+		GPIO_CRH(SWCLK_GPIO_BASE) = swd_phy.swdio_cr_output;
+		nr_idle_cycles &= 7;
+	}
+	while (nr_idle_cycles-- > 0)
+		sw_clock_out_0();
+}
+
+/* the routines below have the same interface as the assembly language
+ * bit loops in swd-hw.c - see there for details */
+
+static inline uint32_t sw_clock_header_out_get_ack(uint32_t w)
+{
+uint32_t ack;
+	GPIO_CRH(SWCLK_GPIO_BASE) = swd_spi.cr_spi_write;
+	sw_spi_write(w, 1);
+	/* the swdio output data register bit selects the pull-up in input mode */
+	GPIO_BSRR(SWDIO_GPIO_BASE) = SWDIO_GPIO_MASK;
+	GPIO_CRH(SWCLK_GPIO_BASE) = swd_phy.swdio_cr_input;
+	/* issue a turnaround cycle */
+	swclk_low();
+	swdelay();
+	swclk_hi();
+	swdelay();
+	/* read the 3-bit ack value */
+	ack = sw_clock_data_in();
+	ack |= sw_clock_data_in() << 1;
+	ack |= sw_clock_data_in() << 2;
+	return ack;
+}
+
+static inline uint64_t sw_clock_word_and_parity_in(void)
+{
+uint32_t x;
+bool parity_error;
+	GPIO_CRH(SWCLK_GPIO_BASE) = swd_spi.cr_spi_read;
+	x = sw_spi_read_word();
+	GPIO_CRH(SWCLK_GPIO_BASE) = swd_phy.swdio_cr_input;
+	parity_error = sw_clock_data_in() ^ __builtin_parity(x);
+	/* issue a turnaround cycle - see sw_insert_idle_cycles() for details */
+	swclk_low();
+	swdelay();
+	swclk_hi();
+	swdelay();
+	sw_config_swdio_output();
+	return x | (uint64_t) parity_error << 32;
+}
+
+static inline void sw_clock_bits_out(uint32_t w, int bit_count)
+{
+int nr_bytes = bit_count >> 3;
+	if (nr_bytes)
+	{
+		GPIO_CRH(SWCLK_GPIO_BASE) = swd_spi.cr_spi_write;
+		sw_spi_write(w, nr_bytes);
+		GPIO_CRH(SWCLK_GPIO_BASE) = swd_phy.swdio_cr_output;
+		w = (nr_bytes < 4) ? w >> (nr_bytes << 3) : 0;
+	}
+	/* bit-bang the bits left over */
+	for (bit_count &= 7; bit_count; bit_count --, w >>= 1)
+		if (w & 1)
+			sw_clock_out_1();
+		else
+			sw_clock_out_0();
+}
+
+static inline void sw_clock_word_and_parity_out(uint32_t w)
+{
+	/* issue a turnaround cycle */
+	swclk_low();
+	swdelay();
+	swclk_hi();
+	swdelay();
+	GPIO_CRH(SWCLK_GPIO_BASE) = swd_spi.cr_spi_write;
+	sw_spi_write(w, 4);
+	GPIO_CRH(SWCLK_GPIO_BASE) = swd_phy.swdio_cr_output;
+	if (__builtin_parity(w))
+		sw_clock_out_1();
+	else
+		sw_clock_out_0();
+}
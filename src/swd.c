@@ -20,8 +20,11 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 */
 
+#include <libopencm3/cm3/systick.h>
+
 #include "swd.h"
 #include <stdbool.h>
+#include <string.h>
 
 #if 1
 #define DBGMSG(x)
@@ -29,7 +32,16 @@ THE SOFTWARE.
 #define dprintint(x)
 #endif
 
+#ifndef SWD_HOST_SIM
+#define SWD_HOST_SIM	0
+#endif
+
+#if SWD_HOST_SIM
+/* host builds - the serial wire is connected to a simulated target */
+#include "host/swd-sim.c"
+#else
 #include "swd-hw.c"
+#endif
 
 volatile struct
 {
@@ -95,6 +107,40 @@ enum SW_DP_REG_ADDRESS_ENUM
 
 };
 
+/*! the dp ABORT register bits */
+enum SW_DP_ABORT_ENUM
+{
+	/*! aborts the ap transaction in progress */
+	SW_DP_ABORT_DAPABORT	= 1 << 0,
+	/*! clears the STICKYCMP flag in the CTRL/STAT register */
+	SW_DP_ABORT_STKCMPCLR	= 1 << 1,
+	/*! clears the STICKYERR flag in the CTRL/STAT register */
+	SW_DP_ABORT_STKERRCLR	= 1 << 2,
+	/*! clears the WDATAERR flag in the CTRL/STAT register */
+	SW_DP_ABORT_WDERRCLR	= 1 << 3,
+	/*! clears the STICKYORUN flag in the CTRL/STAT register */
+	SW_DP_ABORT_ORUNERRCLR	= 1 << 4,
+	/*! clears all of the sticky error flags */
+	SW_DP_ABORT_CLEAR_ERRORS	= SW_DP_ABORT_STKCMPCLR | SW_DP_ABORT_STKERRCLR | SW_DP_ABORT_WDERRCLR | SW_DP_ABORT_ORUNERRCLR,
+};
+
+/*! the dp CTRL/STAT register power control bits */
+enum SW_DP_CTRLSTAT_ENUM
+{
+	/*! system power-up acknowledge */
+	SW_DP_CTRLSTAT_CSYSPWRUPACK	= 1 << 31,
+	/*! system power-up request */
+	SW_DP_CTRLSTAT_CSYSPWRUPREQ	= 1 << 30,
+	/*! debug power-up acknowledge */
+	SW_DP_CTRLSTAT_CDBGPWRUPACK	= 1 << 29,
+	/*! debug power-up request */
+	SW_DP_CTRLSTAT_CDBGPWRUPREQ	= 1 << 28,
+	/*! debug reset request */
+	SW_DP_CTRLSTAT_CDBGRSTREQ	= 1 << 26,
+	/*! the acknowledge bits set when both the system and the debug domains are powered */
+	SW_DP_CTRLSTAT_POWERED	= SW_DP_CTRLSTAT_CSYSPWRUPACK | SW_DP_CTRLSTAT_CDBGPWRUPACK,
+};
+
 
 
 /*! an enumeration for the mem-ap (access port) register addresses */
@@ -145,6 +191,11 @@ static union
 	uint32_t	select_reg;
 }
 sw_select_reg;
+/* true, if the cached value in 'sw_select_reg' is known to match the value
+ * of the target dp SELECT register; this stays true across cmsis-dap
+ * requests, and is only cleared on a serial wire line reset, or if a
+ * write to the SELECT register fails */
+static bool is_select_reg_cache_valid;
 
 /*! this variable holds the last known value of the mem-ap transfer address register (TAR)
  *
@@ -166,6 +217,85 @@ static bool read_dp_ctrl_stat_reg(uint32_t * val);
 static bool write_dp_abort_reg(uint32_t val);
 
 uint32_t nr_swd_idle_cycles = 4;
+volatile bool sw_transfer_abort;
+/* true, if the last transaction was a read that failed because of a bad parity bit */
+static bool is_read_parity_error;
+
+/* serial wire transfer parameters, as set by sw_configure_transfers() */
+static struct
+{
+	/* the number of idle cycles to insert after each transfer */
+	int	idle_cycles;
+	/* the number of times to retry a transfer that has received a 'wait' acknowledge */
+	int	wait_retry_count;
+}
+sw_transfer_config =
+{
+	.idle_cycles		= 0,
+	.wait_retry_count	= 100,
+};
+
+enum
+{
+	/* the number of times to read the data of a read transaction again,
+	 * when the data gets corrupted on the wire */
+	SW_PARITY_ERROR_RETRY_COUNT	= 3,
+	/* the time to wait for the system and debug domains to power up, in microseconds */
+	SW_POWER_UP_TIMEOUT_US	= 100000,
+	/* the number of core clock cycles per microsecond */
+	SW_CORE_CLOCKS_PER_US	= 72,
+};
+
+/* after the data phase of a transfer, the host must either start a new
+ * transfer right away, or clock at least 8 idle cycles before stopping the
+ * serial wire clock (see sw_insert_idle_cycles() for details); instead of
+ * inserting these idle cycles after every transfer, the bus state is
+ * tracked here, and the idle cycles are only inserted by sw_bus_quiesce(),
+ * when the bus is actually going quiet */
+enum
+{
+	/* the number of idle cycles needed before stopping the clock */
+	SW_BUS_QUIESCE_IDLE_CYCLES	= 8,
+};
+
+static enum
+{
+	/* the serial wire clock may be stopped */
+	SW_BUS_QUIET,
+	/* a transfer has completed, and idle cycles must be clocked
+	 * before stopping the serial wire clock */
+	SW_BUS_IDLE_CYCLES_PENDING,
+}
+sw_bus_state;
+
+/*!
+ *	\fn	static void sw_end_transfer(void)
+ *	\brief	inserts the configured number of idle cycles after a transfer, and updates the bus state
+ *
+ *	\return	none */
+static void sw_end_transfer(void)
+{
+	if (sw_transfer_config.idle_cycles)
+		sw_insert_idle_cycles(sw_transfer_config.idle_cycles);
+	sw_bus_state = (sw_transfer_config.idle_cycles >= SW_BUS_QUIESCE_IDLE_CYCLES) ? SW_BUS_QUIET : SW_BUS_IDLE_CYCLES_PENDING;
+}
+
+/*!
+ *	\fn	void sw_bus_quiesce(void)
+ *	\brief	prepares the serial wire bus for stopping the clock
+ *
+ *	this must be called when no further transfers are about to follow;
+ *	idle cycles are only clocked if still needed after the last transfer
+ *
+ *	\return	none */
+void sw_bus_quiesce(void)
+{
+	if (sw_bus_state == SW_BUS_IDLE_CYCLES_PENDING)
+	{
+		sw_insert_idle_cycles(SW_BUS_QUIESCE_IDLE_CYCLES);
+		sw_bus_state = SW_BUS_QUIET;
+	}
+}
 
 /*!
  *	\fn	static inline enum SW_ACK_ENUM sw_set_transfer_addr_reg(uint32_t tar)
@@ -234,22 +364,21 @@ enum SW_ACK_ENUM ack;
 	return ack;
 }
 
-/*!
- *	\fn	static inline int sw_compute_even_parity_bit(uint32_t x)
- *	\brief	computes the even parity checksum bit of a 32 bit input word
- *
- *	\note	this function can be used for computing the even parity checksum
- *		bit for any word width less than 32 - just pad the word
- *		with zeros on the left
- *
- *	\param	x	the 32 bit word for which to compute the even parity
- *			checksum bit
- *	\return	1, if the number of bits set to 1 in the 32 bit 'x' parameter
- *		is odd, 0 - if this number is even */
-static inline int sw_compute_even_parity_bit(uint32_t x)
+/* the serial wire packet request header for a transfer request (see
+ * SW_REQUEST_ENUM) - the start bit, the APnDP, RnW and A[3:2] bits of the
+ * request, the even parity bit over these four bits, the stop bit and
+ * the park bit */
+#define SW_REQUEST_HEADER(request)	(0x81 | (request) << 1 \
+		| (((request) ^ (request) >> 1 ^ (request) >> 2 ^ (request) >> 3) & 1) << 5)
+
+/* the serial wire packet request headers, indexed by transfer request */
+static const uint8_t sw_request_headers[SW_REQUEST_MASK + 1] =
 {
-	return (x ^= x >> 16, x ^= x >> 8, x ^= x >> 4, x ^= x >> 2, x ^= x >> 1) & 1;
-}
+	SW_REQUEST_HEADER(0x0), SW_REQUEST_HEADER(0x1), SW_REQUEST_HEADER(0x2), SW_REQUEST_HEADER(0x3),
+	SW_REQUEST_HEADER(0x4), SW_REQUEST_HEADER(0x5), SW_REQUEST_HEADER(0x6), SW_REQUEST_HEADER(0x7),
+	SW_REQUEST_HEADER(0x8), SW_REQUEST_HEADER(0x9), SW_REQUEST_HEADER(0xa), SW_REQUEST_HEADER(0xb),
+	SW_REQUEST_HEADER(0xc), SW_REQUEST_HEADER(0xd), SW_REQUEST_HEADER(0xe), SW_REQUEST_HEADER(0xf),
+};
 
 
 
@@ -310,54 +439,6 @@ return;
 }
 
 
-/*!
- *	\fn	static enum SW_ACK_ENUM sw_bitseq_xfer(bool is_ap_access, bool is_read_access, int ctrlsel, int a32, uint32_t * data)
- *	\brief	performs a low level serial wire transaction on the serial line hardware
- *
- *	for details on the low level serial wire protocol details,
- *	refer to the "DSA09-PRDC-008772-1-0_ARM_debug_interface_v5_supplement.pdf"
- *	document available for download on the arm site
- *
- *	\note	it is assumed, that on entry to this function, the swdio hardware
- *		signal is configured as an output, and the swclk hardware signal
- *		is also configured as an output - and it is in a high logic
- *		level state; these assertions are also guaranteed to remain
- *		true on exit from this function
- *
- *	\param	is_ap_access	if true, then this transaction is an access port
- *				(ap) access; otherwise (if false), then this is 
- *				a debug port (dp) access; this flag determines
- *				the value of the APnDP bit in the serial wire
- *				packet request phase
- *	\param	is_read_access	if true, then this transaction is a read request;
- *				otherwise (if false), then this transaction is
- *				a write request; this flag determines the value
- *				of the RnW bit in the serial wire packet request
- *				phase
- *	\param	ctrlsel		the value of the CTRLSEL bit in the SELECT dp
- *				register for this access; permitted values are:
- *					-1 - for do not care,
- *					0  - if the CTRLSEL bit should be 0
- *					1  - if the CTRLSEL bit should be 1
- *	\param	a32		the a[3:2] address field for the dp or ap
- *				register access
- *	\param	data		in case of read accesses (is_read_access == true),
- *				the location at which to store the data sampled
- *				in the data transfer phase of the serial wire
- *				protocol; in case of write accesses
- *				(is_read_access == false), the location of the
- *				value which to send over the serial wire during
- *				the data transfer phase of the sw protocol
- *	\return	the acknowledge value received in the acknowledge phase in
- *		the serial wire protocol (an enumerator value from the SW_ACK_ENUM
- *		enumeration)
- *	\note	the 'ctrlsel' parameter seems to be highly redundant, as (right now)
- *		it is never to be used; i(sgs) realised that a bit late, but i will
- *		leave it be; that is probably because i am not too smart...
- *	\warning	if the acknowledge value received during the acknowledge
- *			phase of the sw protocol is not equal to SW_ACK_OK,
- *			then the sw transaction is aborted immediately and
- *			a data transfer phase is *not* performed by this routine */
 
 volatile struct bitseq_log
 {
@@ -370,76 +451,67 @@ volatile struct bitseq_log
 bitseq_log[8];
 int bitseq_idx;
 
-static enum SW_ACK_ENUM sw_bitseq_xfer(bool is_ap_access, bool is_read_access, int ctrlsel, int a32, uint32_t * data)
+/*!
+ *	\fn	static enum SW_ACK_ENUM sw_request_xfer(int request, uint32_t * data)
+ *	\brief	performs a low level serial wire transaction, specified by a transfer request
+ *
+ *	this is the same as sw_bitseq_xfer(), except that the transaction
+ *	is specified by the bits of a transfer request (see SW_REQUEST_ENUM),
+ *	which are used for looking up the serial wire packet request header
+ *	directly; any bits other than the ones in SW_REQUEST_ENUM are ignored */
+static enum SW_ACK_ENUM sw_request_xfer(int request, uint32_t * data)
 {
-int i;
-uint32_t x, ack, rdata, parity;
+uint32_t ack;
+bool is_ap_access = request & SW_REQUEST_APnDP, is_read_access = request & SW_REQUEST_RnW;
+int a32 = (request >> 2) & 3;
 
 	bitseq_log[bitseq_idx] = (struct bitseq_log) { .port = is_ap_access & 1, .access = is_read_access & 1, .a32 = a32, .data = (is_read_access ? 0 : *data), };
 
 counters.bitseq_xfers_total ++;
 
-if (1 || !nr_swd_idle_cycles)
-{
-
-	/* first of all, see if the CTRLSEL bit in the SELECT
-	 * dp register needs to be updated - this is the case
-	 * if either of the dp CTRLSTAT or WCR register is
-	 * being accessed - for other dp registers this is
-	 * a do-not-care case */
-	if (ctrlsel != -1 && (ctrlsel & 1) != sw_select_reg.ctrlsel)
-	{
-		/* the ctrlsel bit must be updated */
-		sw_select_reg.ctrlsel = ctrlsel & 1;
-		ack = sw_bitseq_xfer(false, false, -1, SW_DP_REG_SELECT, & sw_select_reg.select_reg);
-		if (ack != SW_ACK_OK)
-			return (enum SW_ACK_ENUM) ack;
-	}
-	/* if this is a write to the dp SELECT register, update
-	 * the cached value for this register */
-	if (a32 == SW_DP_REG_SELECT && !is_read_access)
-	{
-		sw_select_reg.select_reg = * data;
-	}
-	/* construct the packet request sequence */
-	x = 0;
-	if (is_ap_access)
-		x |= 1 << 1;
-	if (is_read_access)
-		x |= 1 << 2;
-	/* insert a32 field */
-	x |= a32 << 3;
-	/* add parity */
-	x |= sw_compute_even_parity_bit(x) << 5;
-	/* add start and park bits */
-	x |= 0x81;
-
-	ack = clock_header_out_get_ack(x);
+	is_read_parity_error = false;
+	ack = sw_clock_header_out_get_ack(sw_request_headers[request & SW_REQUEST_MASK]);
 
 	if (ack != SW_ACK_OK)
 		sw_report_wire_error(ack, is_ap_access, is_read_access, a32), counters.bitseq_nacks ++;
 
-	if (is_read_access)
+	if (ack == SW_ACK_WAIT || ack == SW_ACK_FAULT)
+		/* there is no data phase after a 'wait' or a 'fault' response - the
+		 * target would take any data clocked out as a new packet request */
+		sw_turnaround_to_output();
+	else if (ack != SW_ACK_OK)
+	{
+		/* no valid response - back off for the length of a data phase,
+		 * without driving swdio */
+		sw_clock_word_and_parity_in();
+	}
+	else if (is_read_access)
 	{
 		uint64_t x;
-		x = clock_word_and_parity_in();
+		x = sw_clock_word_and_parity_in();
 		* data = x;
 
 		if (x >> 32)
 		{
 			DBGMSG("error: bad parity bit received on a sw read transaction\n");
 			counters.bitseq_parity_errors ++;
+			is_read_parity_error = true;
 			ack = SW_ACK_PROTOCOL_ERROR;
 		}
 	}
 	else
 	{
-		clock_word_and_parity_out(* data);
+		sw_clock_word_and_parity_out(* data);
 
 	}
-	/* issue a couple of idle cycles to make sure the sw transfers
-	 * have completed */
-	sw_insert_idle_cycles(10);
+	sw_end_transfer();
+	/* if this is a write to the dp SELECT register, update
+	 * the cached value for this register */
+	if ((request & SW_REQUEST_MASK) == SW_DP_REG_SELECT << 2)
+	{
+		if ((is_select_reg_cache_valid = (ack == SW_ACK_OK)))
+			sw_select_reg.select_reg = * data;
+	}
 	switch (ack)
 	{
 		case SW_ACK_OK:
@@ -459,8 +531,58 @@ if (1 || !nr_swd_idle_cycles)
 	bitseq_idx &= 7;
 	return (enum SW_ACK_ENUM) ack;
 }
-else
+
+/*!
+ *	\fn	static enum SW_ACK_ENUM sw_bitseq_xfer(bool is_ap_access, bool is_read_access, int ctrlsel, int a32, uint32_t * data)
+ *	\brief	performs a low level serial wire transaction on the serial line hardware
+ *
+ *	for details on the low level serial wire protocol details,
+ *	refer to the "DSA09-PRDC-008772-1-0_ARM_debug_interface_v5_supplement.pdf"
+ *	document available for download on the arm site
+ *
+ *	\note	it is assumed, that on entry to this function, the swdio hardware
+ *		signal is configured as an output, and the swclk hardware signal
+ *		is also configured as an output - and it is in a high logic
+ *		level state; these assertions are also guaranteed to remain
+ *		true on exit from this function
+ *
+ *	\param	is_ap_access	if true, then this transaction is an access port
+ *				(ap) access; otherwise (if false), then this is 
+ *				a debug port (dp) access; this flag determines
+ *				the value of the APnDP bit in the serial wire
+ *				packet request phase
+ *	\param	is_read_access	if true, then this transaction is a read request;
+ *				otherwise (if false), then this transaction is
+ *				a write request; this flag determines the value
+ *				of the RnW bit in the serial wire packet request
+ *				phase
+ *	\param	ctrlsel		the value of the CTRLSEL bit in the SELECT dp
+ *				register for this access; permitted values are:
+ *					-1 - for do not care,
+ *					0  - if the CTRLSEL bit should be 0
+ *					1  - if the CTRLSEL bit should be 1
+ *	\param	a32		the a[3:2] address field for the dp or ap
+ *				register access
+ *	\param	data		in case of read accesses (is_read_access == true),
+ *				the location at which to store the data sampled
+ *				in the data transfer phase of the serial wire
+ *				protocol; in case of write accesses
+ *				(is_read_access == false), the location of the
+ *				value which to send over the serial wire during
+ *				the data transfer phase of the sw protocol
+ *	\return	the acknowledge value received in the acknowledge phase in
+ *		the serial wire protocol (an enumerator value from the SW_ACK_ENUM
+ *		enumeration)
+ *	\note	the 'ctrlsel' parameter seems to be highly redundant, as (right now)
+ *		it is never to be used; i(sgs) realised that a bit late, but i will
+ *		leave it be; that is probably because i am not too smart...
+ *	\warning	if the acknowledge value received during the acknowledge
+ *			phase of the sw protocol is not equal to SW_ACK_OK,
+ *			then the sw transaction is aborted immediately and
+ *			a data transfer phase is *not* performed by this routine */
+static enum SW_ACK_ENUM sw_bitseq_xfer(bool is_ap_access, bool is_read_access, int ctrlsel, int a32, uint32_t * data)
 {
+uint32_t ack;
 
 	/* first of all, see if the CTRLSEL bit in the SELECT
 	 * dp register needs to be updated - this is the case
@@ -475,54 +597,56 @@ else
 		if (ack != SW_ACK_OK)
 			return (enum SW_ACK_ENUM) ack;
 	}
-	/* if this is a write to the dp SELECT register, update
-	 * the cached value for this register */
-	if (a32 == SW_DP_REG_SELECT && !is_read_access)
-	{
-		sw_select_reg.select_reg = * data;
-	}
-	/* construct the packet request sequence */
-	x = 0;
-	if (is_ap_access)
-		x |= 1 << 1;
-	if (is_read_access)
-		x |= 1 << 2;
-	/* insert a32 field */
-	x |= a32 << 3;
-	/* add parity */
-	x |= sw_compute_even_parity_bit(x) << 5;
-	/* add start and park bits */
-	x |= 0x81;
-
-	ack = clock_header_out_get_ack_delay(x);
-
-	if (ack != SW_ACK_OK)
-		sw_report_wire_error(ack, is_ap_access, is_read_access, a32);
-
-	if (is_read_access)
-	{
-		uint64_t x;
-		x = clock_word_and_parity_in_delay();
-		* data = x;
-
-		if (x >> 32)
-		{
-			DBGMSG("error: bad parity bit received on a sw read transaction\n");
-			/*! \todo	is this a good idea??? */
-			ack = SW_ACK_FAULT;
-		}
-	}
-	else
-	{
-		clock_word_and_parity_out_delay(* data);
-
-	}
-	/* issue a couple of idle cycles to make sure the sw transfers
-	 * have completed */
-	sw_insert_idle_cycles(10);
+	return sw_request_xfer((is_ap_access ? SW_REQUEST_APnDP : 0) | (is_read_access ? SW_REQUEST_RnW : 0) | a32 << 2, data);
+}
 
-	return (enum SW_ACK_ENUM) ack;
+/*!
+ *	\fn	enum SW_ACK_ENUM sw_transfer(int request, uint32_t * data)
+ *	\brief	performs a serial wire transaction, retrying it while the target responds with a 'wait' acknowledge
+ *
+ *	the transaction is retried at most the number of times configured
+ *	with sw_configure_transfers(), so that a stuck target cannot hang
+ *	the probe; retrying also stops when 'sw_transfer_abort' gets set
+ *
+ *	if the data of a read gets corrupted on the wire (i.e. its parity bit is
+ *	wrong), the data is read again - from the dp RESEND register for ap
+ *	reads and dp RDBUFF reads, which must not be repeated, and by repeating
+ *	the read for other dp reads, which have no side effects
+ *
+ *	\param	request	the transfer request; this has the same layout as
+ *			the low 4 bits of a cmsis-dap transfer request - see
+ *			SW_REQUEST_ENUM; any other bits are ignored
+ *	\param	data	for reads, the location at which to store the data read;
+ *			for writes, the location of the data word to write
+ *	\return	the acknowledge value of the last transaction attempted; this
+ *		is SW_ACK_WAIT if the retry count has been exhausted */
+enum SW_ACK_ENUM sw_transfer(int request, uint32_t * data)
+{
+enum SW_ACK_ENUM ack;
+int retries = sw_transfer_config.wait_retry_count;
+
+	while ((ack = sw_request_xfer(request, data)) == SW_ACK_WAIT && retries -- > 0 && !sw_transfer_abort)
+		;
+	if (is_read_parity_error && ((request & SW_REQUEST_APnDP)
+				|| (request & SW_REQUEST_MASK) == (SW_REQUEST_RnW | SW_DP_REG_RDBUFF << 2)))
+		request = SW_REQUEST_RnW | SW_DP_REG_RESEND << 2;
+	for (retries = SW_PARITY_ERROR_RETRY_COUNT; is_read_parity_error && retries; retries --)
+		ack = sw_request_xfer(request, data);
+	return ack;
 }
+
+/*!
+ *	\fn	void sw_configure_transfers(int idle_cycles, int wait_retry_count)
+ *	\brief	configures the serial wire transfer parameters
+ *
+ *	\param	idle_cycles	the number of idle cycles to insert after each transfer
+ *	\param	wait_retry_count	the number of times to retry a transfer that
+ *				has received a 'wait' acknowledge
+ *	\return	none */
+void sw_configure_transfers(int idle_cycles, int wait_retry_count)
+{
+	sw_transfer_config.idle_cycles = idle_cycles;
+	sw_transfer_config.wait_retry_count = wait_retry_count;
 }
 
 
@@ -553,16 +677,14 @@ static bool write_dp_abort_reg(uint32_t val)
 
 static inline enum SW_ACK_ENUM sw_xfer_write_ap_word(uint32_t data)
 {
-uint32_t x, ack;
+uint32_t ack;
 int retry_cnt;
 
-if (1 || !nr_swd_idle_cycles)
-{
 	retry_cnt = 0;
 
 retry:
 
-	ack = clock_header_out_get_ack(0xbb);
+	ack = sw_clock_header_out_get_ack(sw_request_headers[SW_REQUEST_APnDP | SW_MEM_AP_REG_DRW]);
 
 	if (ack == SW_ACK_WAIT)
 	{
@@ -579,7 +701,7 @@ retry:
 	}
 
 	/* shift data out */
-	clock_word_and_parity_out(data);
+	sw_clock_word_and_parity_out(data);
 
 	if (ack != SW_ACK_OK)
 	{
@@ -588,76 +710,19 @@ retry:
 
 	return (enum SW_ACK_ENUM) ack;
 }
-else
-{
-	retry_cnt = 0;
-
-retry_delay:
-
-	ack = clock_header_out_get_ack_delay(0xbb);
-
-	if (ack == SW_ACK_WAIT)
-	{
-		if (retry_cnt ++ < 4)
-		{
-			DBGMSG("warning: 'wait' sw ack received, retrying transaction"); usbprint("\n");
-			goto retry_delay;
-		}
-		else
-		{
-			DBGMSG("warning: too many sw ack 'wait' responses, aborting transaction"); usbprint("\n");
-			return ack;
-		}
-	}
-
-	/* shift data out */
-	clock_word_and_parity_out_delay(data);
-
-	if (ack != SW_ACK_OK)
-	{
-		sw_report_wire_error(ack, true, false, SW_MEM_AP_REG_DRW >> 2);
-	}
-
-	return (enum SW_ACK_ENUM) ack;
-}
-}
 
 
 
 static inline enum SW_ACK_ENUM sw_xfer_read_ap_word(uint32_t * data)
 {
-uint32_t y, ack;
+uint32_t ack;
 uint64_t x;
 
-if (!nr_swd_idle_cycles)
-{
-	ack = clock_header_out_get_ack(0x9f);
-
-	/* read request */
-	/* shift data in */
-	x = clock_word_and_parity_in();
-	* data = x;
-
-	/* check parity */
-	if (x >> 32)
-	{
-		DBGMSG("error: bad parity bit received on a sw read transaction\n");
-		/*! \todo	is this a good idea??? */
-		ack = SW_ACK_FAULT;
-	}
-
-	if (ack != SW_ACK_OK)
-		sw_report_wire_error(ack, true, true, SW_MEM_AP_REG_DRW >> 2);
-
-	return (enum SW_ACK_ENUM) ack;
-}
-else
-{
-	ack = clock_header_out_get_ack_delay(0x9f);
+	ack = sw_clock_header_out_get_ack(sw_request_headers[SW_REQUEST_APnDP | SW_REQUEST_RnW | SW_MEM_AP_REG_DRW]);
 
 	/* read request */
 	/* shift data in */
-	x = clock_word_and_parity_in_delay();
+	x = sw_clock_word_and_parity_in();
 	* data = x;
 
 	/* check parity */
@@ -674,7 +739,6 @@ else
 	return (enum SW_ACK_ENUM) ack;
 }
 
-}
 
 
 
@@ -749,14 +813,7 @@ enum SW_ACK_ENUM res;
 	 * (section 6.2.5) */
 	/* obtain the posted result from the ap transaction
 	 * just issued */
-	/*! \todo	add timeout/error retry counter */
-	while (1)
-	{
-		res = sw_read_dp(SW_DP_REG_RDBUFF, data);
-		if (res == SW_ACK_OK || res != SW_ACK_WAIT)
-			break;
-	}
-	return res;
+	return sw_transfer(SW_REQUEST_RnW | SW_DP_REG_RDBUFF << 2, data);
 }
 
 
@@ -793,20 +850,13 @@ enum SW_ACK_ENUM res;
 	/* wait for the write buffer to get emptied - perform an access
 	 * that the debug port is able to stall - writing the SELECT 
 	 * register is one such access */
-	/*! \todo	add timeout/error retry counter */
-	while (1)
-	{
-		res = sw_write_dp(SW_DP_REG_SELECT, sw_select_reg.select_reg);
-		if (res == SW_ACK_OK || res != SW_ACK_WAIT)
-			break;
-	}
-	return res;
+	return sw_transfer(SW_DP_REG_SELECT << 2, & sw_select_reg.select_reg);
 }
 
 
 /*!
- *	\fn	static bool sw_reset_bus(void)
- *	\brief	performs a reset of the sw bus
+ *	\fn	static bool sw_line_reset(void)
+ *	\brief	performs a serial wire line reset
  *
  *	\note	it is assumed, that on entry to this function, the swdio hardware
  *		signal is configured as an output, and the swclk hardware signal
@@ -814,7 +864,7 @@ enum SW_ACK_ENUM res;
  *		level state; these assertions are also guaranteed to remain
  *		true on exit from this function
  *
- *	the sw bus reset is achieved by clocking at least
+ *	the line reset is achieved by clocking at least
  *	50 cycles on the bus while holding the swdio in a logic
  *	high level, and issuing at least one idle cycle;
  *	to get the sw bus out of reset and into an idle state,
@@ -824,23 +874,24 @@ enum SW_ACK_ENUM res;
  *	document available for download on the arm site
  *	(appendix b - 'serial wire protocol')
  *
+ *	unlike sw_reset_bus(), this does not touch the dp SELECT and
+ *	the mem-ap TAR registers
+ *
  *	\param	none
- *	\return	true, if the bus reset was successful (i.e. the
- *		sw transaction succeeded and the value read
- *		from the IDCODE register matches the expected one),
- *		false if some error occurred */
-static bool sw_reset_bus(void)
+ *	\return	true, if the line reset was successful (i.e. the
+ *		read of the IDCODE register succeeded), false otherwise */
+static bool sw_line_reset(void)
 {
-int i;
 uint32_t x;
-enum SW_ACK_ENUM ack;
 
+	/* the line reset may reset the dp SELECT register */
+	is_select_reg_cache_valid = false;
 	/* perform a swd reset sequence */
 	/* (1) first - issue
 	 * >= 50 clock cycles while holdind
 	 * swdio hi */
-	for (i = 0; i < 60; i ++)
-		sw_clock_out_1();
+	sw_clock_bits_out(0xffffffff, 32);
+	sw_clock_bits_out(0xffffffff, 28);
 	/* (2) second - issue
 	 * >= 1 clock cycles while holdind
 	 * swdio low (i.e. issue at least
@@ -850,12 +901,35 @@ enum SW_ACK_ENUM ack;
 	 * state machine out of reset and
 	 * into an idle state - read the
 	 * dp idcode register */
+	return sw_read_dp(SW_DP_REG_IDCODE, &x) == SW_ACK_OK;
+}
 
-	ack = sw_read_dp(SW_DP_REG_IDCODE, &x);
-	if (ack != SW_ACK_OK)
-	{
+/*!
+ *	\fn	static bool sw_reset_bus(void)
+ *	\brief	performs a reset of the sw bus
+ *
+ *	\note	it is assumed, that on entry to this function, the swdio hardware
+ *		signal is configured as an output, and the swclk hardware signal
+ *		is also configured as an output - and it is in a high logic
+ *		level state; these assertions are also guaranteed to remain
+ *		true on exit from this function
+ *
+ *	the sw bus reset is a line reset (see sw_line_reset()),
+ *	after which the dp SELECT and the mem-ap TAR registers
+ *	are set to known values
+ *
+ *	\param	none
+ *	\return	true, if the bus reset was successful (i.e. the
+ *		sw transaction succeeded and the value read
+ *		from the IDCODE register matches the expected one),
+ *		false if some error occurred */
+static bool sw_reset_bus(void)
+{
+uint32_t x;
+enum SW_ACK_ENUM ack;
+
+	if (!sw_line_reset())
 		return false;
-	}
 
 	/*! \todo	properly detect and select a memory ap (use the identification
 	 *		register - IDR for that purpose) */
@@ -908,15 +982,12 @@ enum SW_ACK_ENUM ack;
  *		false if some error occurred */
 static bool sw_switch_to_sw(void)
 {
-int i;
-uint32_t x;
-
 	/* perform a swd reset sequence */
 	/* (1) first - issue
 	 * >= 50 clock cycles while holdind
 	 * swdio hi */
-	for (i = 0; i < 60; i ++)
-		sw_clock_out_1();
+	sw_clock_bits_out(0xffffffff, 32);
+	sw_clock_bits_out(0xffffffff, 28);
 	/* (2) second - issue the 16 bit jtag-to-serial-wire
 	 * sequence (described in the arm adiv5
 	 * supplement document, available on the
@@ -924,16 +995,69 @@ uint32_t x;
 	 * DSA09-PRDC-008772-1-0_ARM_debug_interface_v5_supplement.pdf)
 	 *
 	 * this sequence is 0xe79e - transmitted lsb first */
-	x = 0xe79e;
-	for (i = 0; i < 16; i++, x >>= 1)
-		if (x & 1)
-			sw_clock_out_1();
-		else
-			sw_clock_out_0();
+	sw_clock_bits_out(0xe79e, 16);
 	/* after this - perform an usual sw bus reset sequence */
 	return sw_reset_bus();
 }
 
+/*!
+ *	\fn	void sw_swj_sequence(const uint8_t * sequence, int bit_count)
+ *	\brief	clocks out an arbitrary bit sequence on swdio (the jtag tms signal)
+ *
+ *	this is used for issuing line resets, protocol switching and dormant
+ *	state wakeup sequences; the bits are clocked out 32 at a time, with
+ *	the same bit loops that are used for the data phases
+ *
+ *	as the sequence may reset the dp, or switch it to another protocol,
+ *	the dp SELECT register cache is invalidated
+ *
+ *	\param	sequence	the bits to clock out, least significant bit
+ *				of the first byte first
+ *	\param	bit_count	the number of bits to clock out
+ *	\return	none */
+void sw_swj_sequence(const uint8_t * sequence, int bit_count)
+{
+uint32_t w;
+int i, n;
+
+	is_select_reg_cache_valid = false;
+	for (; bit_count > 0; bit_count -= n)
+	{
+		n = (bit_count < 32) ? bit_count : 32;
+		for (w = i = 0; i < n; i += 8)
+			w |= (uint32_t) * sequence ++ << i;
+		sw_clock_bits_out(w, n);
+	}
+	/* the state the bus is left in is up to the host */
+	sw_bus_state = SW_BUS_QUIET;
+}
+
+/*!
+ *	\fn	void sw_set_pins(int pin_output, int pin_select)
+ *	\brief	drives the serial wire pins directly
+ *
+ *	\note	the transfer routines expect swclk to be high, and swdio to be
+ *		driven by the probe - it is up to the caller to leave the
+ *		pins in this state before the next transfer
+ *
+ *	\param	pin_output	the levels to drive the pins to - see SW_PIN_ENUM
+ *	\param	pin_select	the pins to drive - see SW_PIN_ENUM
+ *	\return	none */
+void sw_set_pins(int pin_output, int pin_select)
+{
+	sw_phy_set_pins(pin_output, pin_select);
+}
+
+/*!
+ *	\fn	int sw_get_pins(void)
+ *	\brief	reads the levels of the serial wire pins
+ *
+ *	\return	the pin levels - see SW_PIN_ENUM */
+int sw_get_pins(void)
+{
+	return sw_phy_get_pins();
+}
+
 /*!
  *	\fn	uint32_t sw_read_dp_idcode(void)
  *	\brief	retrieves the 'idcode' dp register
@@ -1000,7 +1124,7 @@ retry:
 				if (cs & ((1 << 7) | (1 << 5) | (1 << 4) | (1 << 1)))
 				{
 					sw_reset_bus();
-					write_dp_abort_reg(0x1e);
+					write_dp_abort_reg(SW_DP_ABORT_CLEAR_ERRORS);
 				}
 			}
 		}
@@ -1048,9 +1172,7 @@ reload_tar_register:
 		res = (sw_xfer_read_ap_word(data) == SW_ACK_OK);
 		if (!res)
 		{
-			/* issue a couple of idle cycles to make sure the sw transfers
-			 * have completed */
-			sw_insert_idle_cycles(10);
+			sw_end_transfer();
 			return false;
 		}
 		if (is_tar_reg_reload_needed())
@@ -1082,9 +1204,7 @@ restart_target_read:
 				goto restart_target_read;
 		}
 
-		/* issue a couple of idle cycles to make sure the sw transfers
-		 * have completed */
-		sw_insert_idle_cycles(10);
+		sw_end_transfer();
 
 		if (res)
 			while (1)
@@ -1135,7 +1255,7 @@ retry:
 				if (cs & ((1 << 7) | (1 << 5) | (1 << 4) | (1 << 1)))
 				{
 					sw_reset_bus();
-					write_dp_abort_reg(0x1e);
+					write_dp_abort_reg(SW_DP_ABORT_CLEAR_ERRORS);
 				}
 			}
 		}
@@ -1180,9 +1300,7 @@ reload_tar_register:
 		res = (sw_xfer_write_ap_word(* data) == SW_ACK_OK);
 		if (!res)
 		{
-			/* issue a couple of idle cycles to make sure the sw transfers
-			 * have completed */
-			sw_insert_idle_cycles(10);
+			sw_end_transfer();
 			return false;
 		}
 
@@ -1227,9 +1345,7 @@ restart_target_write:
 			wordcnt --;
 		}
 
-		/* issue a couple of idle cycles to make sure the sw transfers
-		 * have completed */
-		sw_insert_idle_cycles(10);
+		sw_end_transfer();
 
 		if (res)
 		{
@@ -1252,6 +1368,39 @@ restart_target_write:
 }
 
 
+/*!
+ *	\fn	static bool sw_wait_for_power_up(uint32_t * ctrl_stat)
+ *	\brief	waits for the system and debug domains to acknowledge a power-up request
+ *
+ *	the dp CTRL/STAT register is polled until both of its power-up
+ *	acknowledge bits are set, for at most SW_POWER_UP_TIMEOUT_US; time
+ *	is measured with the free running systick counter, which is started
+ *	in main(), so the timeout does not depend on the serial wire clock rate
+ *
+ *	\param	ctrl_stat	a pointer to where to store the value of the dp
+ *			CTRL/STAT register last read
+ *	\return	true, if both domains have been powered up, false if the
+ *		power-up timed out, or an error occurred */
+static bool sw_wait_for_power_up(uint32_t * ctrl_stat)
+{
+uint32_t cycles = SW_POWER_UP_TIMEOUT_US * SW_CORE_CLOCKS_PER_US, last = systick_get_value(), now, elapsed;
+
+	while (1)
+	{
+		if (!read_dp_ctrl_stat_reg(ctrl_stat))
+			return false;
+		if ((* ctrl_stat & SW_DP_CTRLSTAT_POWERED) == (uint32_t) SW_DP_CTRLSTAT_POWERED)
+			return true;
+		/* the systick counter counts down, and wraps around every 2^24 cycles */
+		now = systick_get_value();
+		elapsed = (last - now) & 0xffffff;
+		last = now;
+		if (elapsed >= cycles)
+			return false;
+		cycles -= elapsed;
+	}
+}
+
 bool init_sw_hardware(void)
 {
 uint32_t x;
@@ -1259,10 +1408,7 @@ bool res;
 
 	res = true;
 	/* configure pins */
-	sw_config_swdio_output();
-	sw_config_swclk_output();
-	swdio_hi();
-	swclk_hi();
+	sw_phy_init();
 	/* configure the target reset signal */
 	swdelay();
 	res &= sw_switch_to_sw();
@@ -1313,7 +1459,7 @@ bool res;
 	if (x & ((1 << 7) | (1 << 5) | (1 << 4) | (1 << 1)))
 	{
 		usbprint("ctrl/stat errors detected - trying to clear errors\n");
-		if (!write_dp_abort_reg(0x1e))
+		if (!write_dp_abort_reg(SW_DP_ABORT_CLEAR_ERRORS))
 		{
 			usbprint("failed to write ctrl/stat register, aborting...\n");
 			return false;
@@ -1334,19 +1480,20 @@ bool res;
 		usbprint("\n");
 	}
 
-	/* power up system and debug blocks, reset debug block */
-	res &= sw_write_dp(SW_DP_REG_CTRLSTAT, 0x54000000);
-	for (x = 0; x < 1024; x ++)
-		swdelay();
-
-	res &= sw_write_dp(SW_DP_REG_CTRLSTAT, 0x50000000);
-	for (x = 0; x < 1024; x ++)
-		swdelay();
-
-	DBGMSG("ctrl/stat after powering debug and system domains: ");
-	x = -1;
-	read_dp_ctrl_stat_reg(&x);
-	dprintint(x);
+	/* power up system and debug blocks, reset debug block - unless
+	 * they are already powered up, e.g. when reconnecting to a target */
+	if ((x & SW_DP_CTRLSTAT_POWERED) != (uint32_t) SW_DP_CTRLSTAT_POWERED)
+	{
+		if (sw_write_dp(SW_DP_REG_CTRLSTAT, SW_DP_CTRLSTAT_CSYSPWRUPREQ | SW_DP_CTRLSTAT_CDBGPWRUPREQ | SW_DP_CTRLSTAT_CDBGRSTREQ) != SW_ACK_OK
+				|| !sw_wait_for_power_up(& x)
+				|| sw_write_dp(SW_DP_REG_CTRLSTAT, SW_DP_CTRLSTAT_CSYSPWRUPREQ | SW_DP_CTRLSTAT_CDBGPWRUPREQ) != SW_ACK_OK)
+		{
+			usbprint("failed to power up the debug and system domains, aborting...\n");
+			return false;
+		}
+		DBGMSG("ctrl/stat after powering debug and system domains: ");
+		dprintint(x);
+	}
 
 	/* configure the cortex ahb-ap csw register
 	 * for details, consult the arm document:
@@ -1362,18 +1509,61 @@ bool res;
 	dprintint(x);
 	sw_read_mem_ap(0, & x);
 	
-	memset(&counters, 0, sizeof counters);
+	memset((void *) & counters, 0, sizeof counters);
 
 	return true;
 }
 
+/*!
+ *	\fn	bool sw_recover(enum SW_ACK_ENUM ack)
+ *	\brief	brings the debug port back into a usable state after a failed transfer
+ *
+ *	the recovery is done in steps of increasing cost, and stops at the
+ *	first step that succeeds:
+ *	- after a 'fault' acknowledge, the sticky error flags in the dp
+ *	CTRL/STAT register are cleared by writing to the dp ABORT register
+ *	- after a 'wait' acknowledge (i.e. the retry count has been exhausted),
+ *	the stalled ap transaction is aborted, and the sticky error flags are
+ *	cleared, also by writing to the dp ABORT register
+ *	- after a protocol error (i.e. the target did not respond, or the
+ *	data got corrupted on the wire), or if writing to the dp ABORT register
+ *	failed above, a line reset is performed, and the dp ABORT register
+ *	is written again
+ *	- if all of the above fails, the target is connected to again, by
+ *	calling init_sw_hardware()
+ *
+ *	the dp SELECT and the mem-ap TAR registers are left untouched (unless
+ *	reconnecting to the target), so that the host can resume its transfers
+ *	without setting them up again
+ *
+ *	\param	ack	the acknowledge value of the failed transfer
+ *	\return	true, if the debug port is usable again, false otherwise */
+bool sw_recover(enum SW_ACK_ENUM ack)
+{
+	switch (ack)
+	{
+		case SW_ACK_OK:
+			return true;
+		case SW_ACK_FAULT:
+			if (write_dp_abort_reg(SW_DP_ABORT_CLEAR_ERRORS))
+				return true;
+			break;
+		case SW_ACK_WAIT:
+			if (write_dp_abort_reg(SW_DP_ABORT_DAPABORT | SW_DP_ABORT_CLEAR_ERRORS))
+				return true;
+			break;
+		default:
+			break;
+	}
+	if (sw_line_reset() && write_dp_abort_reg(SW_DP_ABORT_DAPABORT | SW_DP_ABORT_CLEAR_ERRORS))
+		return true;
+	return init_sw_hardware();
+}
+
 
 enum SW_ACK_ENUM read_dp(int address, uint32_t * data)
 {
-enum SW_ACK_ENUM ack;
-	
-	while ((ack = sw_bitseq_xfer(false, true, -1, address, data)) != SW_ACK_OK && ack == SW_ACK_WAIT);
-	return ack;
+	return sw_transfer(SW_REQUEST_RnW | address << 2, data);
 }
 
 enum SW_ACK_ENUM read_ap(int address, uint32_t * data)
@@ -1381,63 +1571,129 @@ enum SW_ACK_ENUM read_ap(int address, uint32_t * data)
 enum SW_ACK_ENUM ack;
 	
 	/* post read request */
-	while ((ack = sw_bitseq_xfer(true, true, -1, address, data)) != SW_ACK_OK && ack == SW_ACK_WAIT);
-	if (ack != SW_ACK_OK)
+	if ((ack = read_ap_posted(address, data)) != SW_ACK_OK)
 		return ack;
 	/* read back data */
+	return read_ap_posted_result(data);
+}
+
+/*!
+ *	\fn	enum SW_ACK_ENUM read_ap_posted(int address, uint32_t * data)
+ *	\brief	posts an access port (ap) register read
+ *
+ *	ap register reads are posted - the data returned by an ap read
+ *	transaction is the result of the previous ap read; this makes it
+ *	possible to pipeline consecutive ap reads, and only read the result
+ *	of the last one (with read_ap_posted_result()) at the end - for
+ *	details, consult the arm document:
+ *	IHI0031A_ARM_debug_interface_v5.pdf
+ *	section 5.4 - 'protocol description'
+ *	(and more specifically section 5.4.2 - 'the ok response')
+ *
+ *	\param	address	the ap register address (bits 3 and 2 of the address)
+ *	\param	data	a pointer to where to store the result of the previously
+ *			posted ap read; this is unpredictable if there is no
+ *			previously posted ap read
+ *	\return	the acknowledge value of the serial wire transaction */
+enum SW_ACK_ENUM read_ap_posted(int address, uint32_t * data)
+{
+	return sw_transfer(SW_REQUEST_APnDP | SW_REQUEST_RnW | address << 2, data);
+}
+
+/*!
+ *	\fn	enum SW_ACK_ENUM read_ap_posted_result(uint32_t * data)
+ *	\brief	retrieves the result of the last posted access port (ap) register read
+ *
+ *	the result is read from the debug port (dp) RDBUFF register
+ *
+ *	\param	data	a pointer to where to store the result
+ *	\return	the acknowledge value of the serial wire transaction */
+enum SW_ACK_ENUM read_ap_posted_result(uint32_t * data)
+{
 	return read_dp(SW_DP_REG_RDBUFF, data);
 }
+
 enum SW_ACK_ENUM write_dp(int address, uint32_t data)
 {
 enum SW_ACK_ENUM ack;
 	
-	while ((ack = sw_bitseq_xfer(false, false, -1, address, & data)) != SW_ACK_OK && ack == SW_ACK_WAIT);
-	if (ack != SW_ACK_OK)
-		return ack;
-	/* read the read buffer to make sure the dp write buffer is flushed */
-	ack = read_dp(SW_DP_REG_RDBUFF, & data);
+	/* hosts often rewrite the SELECT register with an unchanged
+	 * value - elide such writes, if the cached value is valid */
+	if (address == SW_DP_REG_SELECT && is_select_reg_cache_valid && data == sw_select_reg.select_reg)
+		return SW_ACK_OK;
+	ack = sw_transfer(address << 2, & data);
 	if (ack != SW_ACK_OK)
 		return ack;
-	/* check transaction */
-	if ((ack = read_dp(SW_DP_REG_CTRLSTAT, & data)) != SW_ACK_OK)
-		return ack;
-	if (data & ((1 << 7) | (1 << 5) | (1 << 4) | (1 << 1)))
-	{
-		/* write to the abort register to clear any errors */
-		sw_bitseq_xfer(false, false, -1, SW_DP_REG_AP_ABORT, (uint32_t [1]) { [0] = 0x1f, });
-		return SW_ACK_PROTOCOL_ERROR;
-	}
-	return ack;
+	return check_posted_writes();
 }
 
 enum SW_ACK_ENUM write_ap(int address, uint32_t data)
 {
 volatile enum SW_ACK_ENUM ack;
 	
+	ack = write_ap_posted(address, data);
+	if (ack != SW_ACK_OK)
+		return ack;
+	ack = check_posted_writes();
+	if (ack != SW_ACK_OK)
+		counters.write_ap_err_cnt ++;
+	return ack;
+}
+
+/*!
+ *	\fn	enum SW_ACK_ENUM write_ap_posted(int address, uint32_t data)
+ *	\brief	writes to an access port (ap) register, without checking for write errors
+ *
+ *	ap register writes are buffered by the debug port, and an ok
+ *	acknowledge only means that the write has been accepted - errors
+ *	in carrying out the write are only reported in the sticky error
+ *	flags of the dp CTRL/STAT register; this makes it possible to issue
+ *	a stream of ap writes, and only check for errors (with
+ *	check_posted_writes()) at the end of the stream - for details,
+ *	consult the arm document:
+ *	IHI0031A_ARM_debug_interface_v5.pdf
+ *	section 5.4 - 'protocol description'
+ *	(and more specifically section 5.4.7 - 'sw-dp write buffering')
+ *
+ *	\param	address	the ap register address (bits 3 and 2 of the address)
+ *	\param	data	the data word to write
+ *	\return	the acknowledge value of the serial wire transaction */
+enum SW_ACK_ENUM write_ap_posted(int address, uint32_t data)
+{
+enum SW_ACK_ENUM ack;
+
 	counters.write_ap_cnt ++;
-	while ((ack = sw_bitseq_xfer(true, false, -1, address, & data)) != SW_ACK_OK && ack == SW_ACK_WAIT)
-		counters.wait_cnt ++;
+	ack = sw_transfer(SW_REQUEST_APnDP | address << 2, & data);
 	if (ack != SW_ACK_OK)
-	{
 		counters.write_ap_err_cnt ++;
-		return ack;
-	}
+	return ack;
+}
+
+/*!
+ *	\fn	enum SW_ACK_ENUM check_posted_writes(void)
+ *	\brief	waits for the buffered writes to complete, and checks them for errors
+ *
+ *	the sticky error flags in the dp CTRL/STAT register are not cleared
+ *	here - this is left to sw_recover(), which the caller must invoke
+ *	when SW_ACK_FAULT is returned
+ *
+ *	\return	SW_ACK_OK if all buffered writes completed successfully,
+ *		SW_ACK_FAULT if a sticky error flag was set, or the
+ *		acknowledge value of a failed serial wire transaction */
+enum SW_ACK_ENUM check_posted_writes(void)
+{
+enum SW_ACK_ENUM ack;
+uint32_t data;
+
 	/* read the read buffer to make sure the dp write buffer is flushed */
 	ack = read_dp(SW_DP_REG_RDBUFF, & data);
 	if (ack != SW_ACK_OK)
-	{
-		counters.write_ap_err_cnt ++;
 		return ack;
-	}
 	/* check transaction */
 	if ((ack = read_dp(SW_DP_REG_CTRLSTAT, & data)) != SW_ACK_OK)
 		return ack;
 	if (data & ((1 << 7) | (1 << 5) | (1 << 4) | (1 << 1)))
-	{
-		/* write to the abort register to clear any errors */
-		sw_bitseq_xfer(false, false, -1, SW_DP_REG_AP_ABORT, (uint32_t [1]) { [0] = 0x1f, });
-		return SW_ACK_PROTOCOL_ERROR;
-	}
+		return SW_ACK_FAULT;
 	return ack;
 }
 
@@ -35,20 +35,61 @@ enum SW_ACK_ENUM
 	SW_ACK_PROTOCOL_ERROR	= 7,
 };
 
+/*! the serial wire pins, for sw_set_pins() and sw_get_pins() */
+enum SW_PIN_ENUM
+{
+	SW_PIN_SWCLK	= 1 << 0,
+	SW_PIN_SWDIO	= 1 << 1,
+};
+
+/*! the bits of a serial wire transfer request; these have the same layout
+ * as the low 4 bits of a cmsis-dap transfer request, so that cmsis-dap
+ * transfer requests can be passed to sw_transfer() directly */
+enum SW_REQUEST_ENUM
+{
+	/*! set for an access port (ap) access, clear for a debug port (dp) access */
+	SW_REQUEST_APnDP	= 1 << 0,
+	/*! set for a read access, clear for a write access */
+	SW_REQUEST_RnW		= 1 << 1,
+	/*! bits 2 and 3 of the register address */
+	SW_REQUEST_A2		= 1 << 2,
+	SW_REQUEST_A3		= 1 << 3,
+	SW_REQUEST_MASK		= SW_REQUEST_APnDP | SW_REQUEST_RnW | SW_REQUEST_A2 | SW_REQUEST_A3,
+};
+
 bool init_sw_hardware(void);
+bool sw_recover(enum SW_ACK_ENUM ack);
 uint32_t sw_read_dp_idcode(void);
 uint32_t sw_read_ap_dbgbase(void);
 bool sw_read_mem_ap(uint32_t addr, uint32_t * data);
 bool sw_read_mem_ap_words(uint32_t addr, uint32_t * data, uint32_t wordcnt);
 bool sw_write_mem_ap(uint32_t addr, uint32_t data);
 bool sw_write_mem_ap_words(uint32_t addr, uint32_t * data, uint32_t wordcnt);
+enum SW_ACK_ENUM sw_transfer(int request, uint32_t * data);
 enum SW_ACK_ENUM read_dp(int address, uint32_t * data);
 enum SW_ACK_ENUM read_ap(int address, uint32_t * data);
+enum SW_ACK_ENUM read_ap_posted(int address, uint32_t * data);
+enum SW_ACK_ENUM read_ap_posted_result(uint32_t * data);
 enum SW_ACK_ENUM write_dp(int address, uint32_t data);
 enum SW_ACK_ENUM write_ap(int address, uint32_t data);
+enum SW_ACK_ENUM write_ap_posted(int address, uint32_t data);
+enum SW_ACK_ENUM check_posted_writes(void);
+uint32_t sw_set_clock(uint32_t hz);
+void sw_configure_transfers(int idle_cycles, int wait_retry_count);
+void sw_bus_quiesce(void);
+void sw_swj_sequence(const uint8_t * sequence, int bit_count);
+void sw_set_pins(int pin_output, int pin_select);
+int sw_get_pins(void);
 
 /* number of serial wire idle cycles to perform when communicating over
  * the serial wire debug bus; basically, this determines the rate of
- * the serial wire clock */
+ * the serial wire clock - use sw_set_clock() for setting it */
 extern uint32_t nr_swd_idle_cycles;
 
+/* when set (from the usb interrupt handler, on a cmsis-dap transfer abort
+ * request), the serial wire transfers in progress are aborted as soon as
+ * possible; this is polled by sw_transfer() while retrying transfers that
+ * receive a 'wait' acknowledge, and by the cmsis-dap transfer loops,
+ * which clear it when done */
+extern volatile bool sw_transfer_abort;
+
@@ -0,0 +1,196 @@
+/*
+Copyright (c) 2015-2016 stoyan shopov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* the uart swo phy - the swo trace is received on the usart1 rx pin
+ * (pa10), and is transferred to the trace buffer by dma1 channel 5 (the
+ * usart1 rx dma request channel), running in circular mode; the cpu only
+ * handles the dma half transfer and transfer complete interrupts, which
+ * are used for keeping count of the bytes received
+ *
+ * usart1 is clocked from the apb2 bus at 72 MHz, and oversamples by 16,
+ * so the highest baudrate supported is 4.5 Mbaud
+ *
+ * this file is included by swo.c, and must not be compiled on its own */
+
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/usart.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/cm3/nvic.h>
+
+#define SWO_USART		USART1
+#define SWO_DMA_CHANNEL		DMA_CHANNEL5
+
+enum
+{
+	/* the usart1 kernel clock rate */
+	SWO_USART_CLOCK_HZ	= 72000000,
+	/* the smallest usart baudrate divider allowed - with 16 times
+	 * oversampling, the divider mantissa must be at least 1 */
+	SWO_USART_MIN_DIVIDER	= 16,
+};
+
+/* the number of dma half transfer and transfer complete interrupts
+ * since capture was started - i.e., the number of trace buffer halves
+ * filled */
+static volatile uint32_t swo_dma_half_buffers;
+/* set on a usart framing, noise or overrun error */
+static volatile bool swo_phy_stream_error;
+
+/*!
+ *	\fn	static void swo_phy_init(void)
+ *	\brief	configures the swo pin and enables the usart and dma peripherals */
+static void swo_phy_init(void)
+{
+	rcc_periph_clock_enable(RCC_GPIOA);
+	rcc_periph_clock_enable(RCC_USART1);
+	rcc_periph_clock_enable(RCC_DMA1);
+	/* swo is pulled up, so that an unconnected swo pin reads as an idle line */
+	gpio_set(GPIOA, GPIO_USART1_RX);
+	gpio_set_mode(GPIOA, GPIO_MODE_INPUT, GPIO_CNF_INPUT_PULL_UPDOWN, GPIO_USART1_RX);
+	nvic_enable_irq(NVIC_DMA1_CHANNEL5_IRQ);
+	nvic_enable_irq(NVIC_USART1_IRQ);
+}
+
+/*!
+ *	\fn	static uint32_t swo_phy_set_baudrate(uint32_t baudrate)
+ *	\brief	sets the usart baudrate
+ *
+ *	\param	baudrate	the requested baudrate
+ *	\return	the baudrate actually set, zero if the baudrate is too low */
+static uint32_t swo_phy_set_baudrate(uint32_t baudrate)
+{
+uint32_t divider;
+
+	if (!baudrate)
+		return 0;
+	divider = (SWO_USART_CLOCK_HZ + baudrate / 2) / baudrate;
+	if (divider < SWO_USART_MIN_DIVIDER)
+		divider = SWO_USART_MIN_DIVIDER;
+	if (divider > 0xffff)
+		return 0;
+	USART_BRR(SWO_USART) = divider;
+	return SWO_USART_CLOCK_HZ / divider;
+}
+
+/*!
+ *	\fn	static void swo_phy_start(void)
+ *	\brief	starts receiving trace data at the start of the trace buffer */
+static void swo_phy_start(void)
+{
+	swo_dma_half_buffers = 0;
+	swo_phy_stream_error = false;
+
+	dma_channel_reset(DMA1, SWO_DMA_CHANNEL);
+	dma_set_peripheral_address(DMA1, SWO_DMA_CHANNEL, (uint32_t) & USART_DR(SWO_USART));
+	dma_set_memory_address(DMA1, SWO_DMA_CHANNEL, (uint32_t) swo_buffer);
+	dma_set_number_of_data(DMA1, SWO_DMA_CHANNEL, SWO_BUFFER_SIZE);
+	dma_set_read_from_peripheral(DMA1, SWO_DMA_CHANNEL);
+	dma_enable_memory_increment_mode(DMA1, SWO_DMA_CHANNEL);
+	dma_set_peripheral_size(DMA1, SWO_DMA_CHANNEL, DMA_CCR_PSIZE_8BIT);
+	dma_set_memory_size(DMA1, SWO_DMA_CHANNEL, DMA_CCR_MSIZE_8BIT);
+	dma_set_priority(DMA1, SWO_DMA_CHANNEL, DMA_CCR_PL_VERY_HIGH);
+	dma_enable_circular_mode(DMA1, SWO_DMA_CHANNEL);
+	dma_enable_half_transfer_interrupt(DMA1, SWO_DMA_CHANNEL);
+	dma_enable_transfer_complete_interrupt(DMA1, SWO_DMA_CHANNEL);
+	dma_enable_channel(DMA1, SWO_DMA_CHANNEL);
+
+	usart_set_databits(SWO_USART, 8);
+	usart_set_stopbits(SWO_USART, USART_STOPBITS_1);
+	usart_set_parity(SWO_USART, USART_PARITY_NONE);
+	usart_set_flow_control(SWO_USART, USART_FLOWCONTROL_NONE);
+	usart_set_mode(SWO_USART, USART_MODE_RX);
+	usart_enable_rx_dma(SWO_USART);
+	/* the error interrupt is generated on framing, noise and overrun
+	 * errors, when dma reception is enabled */
+	USART_CR3(SWO_USART) |= USART_CR3_EIE;
+	usart_enable(SWO_USART);
+}
+
+/*!
+ *	\fn	static void swo_phy_stop(void)
+ *	\brief	stops receiving trace data */
+static void swo_phy_stop(void)
+{
+	usart_disable(SWO_USART);
+	usart_disable_rx_dma(SWO_USART);
+	dma_disable_channel(DMA1, SWO_DMA_CHANNEL);
+}
+
+/*!
+ *	\fn	static uint32_t swo_phy_bytes_received(void)
+ *	\brief	returns the number of bytes received since capture was started
+ *
+ *	this is computed from the dma transfer counter, and the number of
+ *	trace buffer halves filled; the dma transfer complete interrupt may
+ *	still be pending when this is called (e.g. from the usb interrupt
+ *	handler), after the dma transfer counter has already wrapped around -
+ *	this is detected, and accounted for here */
+static uint32_t swo_phy_bytes_received(void)
+{
+uint32_t half_buffers, position;
+
+	do
+	{
+		half_buffers = swo_dma_half_buffers;
+		position = SWO_BUFFER_SIZE - DMA_CNDTR(DMA1, SWO_DMA_CHANNEL);
+	}
+	while (half_buffers != swo_dma_half_buffers);
+	if ((half_buffers & 1) && position < SWO_BUFFER_SIZE / 2)
+		half_buffers ++;
+	return (half_buffers >> 1) * SWO_BUFFER_SIZE + position;
+}
+
+/*!
+ *	\fn	static bool swo_phy_is_stream_error(void)
+ *	\brief	tells if a usart error has occurred since capture was started */
+static bool swo_phy_is_stream_error(void)
+{
+	return swo_phy_stream_error;
+}
+
+void dma1_channel5_isr(void)
+{
+	if (dma_get_interrupt_flag(DMA1, SWO_DMA_CHANNEL, DMA_HTIF))
+	{
+		dma_clear_interrupt_flags(DMA1, SWO_DMA_CHANNEL, DMA_HTIF);
+		swo_dma_half_buffers ++;
+	}
+	if (dma_get_interrupt_flag(DMA1, SWO_DMA_CHANNEL, DMA_TCIF))
+	{
+		dma_clear_interrupt_flags(DMA1, SWO_DMA_CHANNEL, DMA_TCIF);
+		swo_dma_half_buffers ++;
+	}
+}
+
+void usart1_isr(void)
+{
+	/* the usart error flags are only cleared by reading the data register,
+	 * which is left to the dma; as the stream error status is sticky,
+	 * the error interrupt is disabled here instead, until capture is
+	 * started again */
+	if (USART_SR(SWO_USART) & (USART_SR_FE | USART_SR_NE | USART_SR_ORE))
+	{
+		swo_phy_stream_error = true;
+		USART_CR3(SWO_USART) &= ~USART_CR3_EIE;
+	}
+}
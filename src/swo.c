@@ -0,0 +1,261 @@
+/*
+Copyright (c) 2015-2016 stoyan shopov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* serial wire output (swo) trace capture; the trace data is received by
+ * the swo phy (swo-hw.c) straight into a circular trace buffer, and is
+ * read by the consumers - the cmsis-dap DAP_SWO_Data command, or the usb
+ * trace streaming endpoint - straight from that buffer; the buffer is
+ * never copied elsewhere, so that capturing trace data costs no cpu time
+ * on the serial wire command path
+ *
+ * the phy keeps count of the bytes received since capture was started,
+ * and the number of bytes consumed is kept here - the difference of
+ * these is the amount of trace data in the buffer; if the phy gets more
+ * than a buffer length ahead of the consumers, the data in the buffer is
+ * discarded, and a buffer overrun is reported */
+
+#include "swo.h"
+#include <string.h>
+
+#ifndef SWD_HOST_SIM
+#define SWD_HOST_SIM	0
+#endif
+
+/* the trace buffer */
+static uint8_t swo_buffer[SWO_BUFFER_SIZE] __attribute__((aligned(4)));
+
+#if SWD_HOST_SIM
+/* host builds - trace data is fed by the host harness */
+#include "host/swo-sim.c"
+#else
+#include "swo-hw.c"
+#endif
+
+static struct
+{
+	enum SWO_MODE_ENUM	mode;
+	enum SWO_TRANSPORT_ENUM	transport;
+	/* the baudrate in effect, zero if none has been set */
+	uint32_t		baudrate;
+	bool			is_active;
+	/* true, if trace data has been discarded since capture was started */
+	volatile bool		is_overrun;
+	/* the number of bytes consumed since capture was started */
+	volatile uint32_t	bytes_consumed;
+}
+swo;
+
+/*!
+ *	\fn	bool swo_set_mode(enum SWO_MODE_ENUM mode)
+ *	\brief	sets the trace capture mode
+ *
+ *	\param	mode	the trace capture mode; only uart encoded swo is supported
+ *	\return	true, if the mode has been set, false if the mode is not
+ *		supported, or if capture is active */
+bool swo_set_mode(enum SWO_MODE_ENUM mode)
+{
+	if (swo.is_active)
+		return false;
+	switch (mode)
+	{
+		case SWO_MODE_UART:
+			swo_phy_init();
+			/* fall through */
+		case SWO_MODE_OFF:
+			swo.mode = mode;
+			return true;
+		default:
+			swo.mode = SWO_MODE_OFF;
+			return false;
+	}
+}
+
+/*!
+ *	\fn	uint32_t swo_set_baudrate(uint32_t baudrate)
+ *	\brief	sets the trace capture baudrate
+ *
+ *	\param	baudrate	the requested baudrate, in bits per second
+ *	\return	the baudrate actually set, which is the closest one
+ *		available; zero if the baudrate cannot be set, or if
+ *		capture is active */
+uint32_t swo_set_baudrate(uint32_t baudrate)
+{
+	if (swo.is_active)
+		return 0;
+	return swo.baudrate = swo_phy_set_baudrate(baudrate);
+}
+
+/*!
+ *	\fn	bool swo_set_transport(enum SWO_TRANSPORT_ENUM transport)
+ *	\brief	sets the way in which the captured trace data is transported to the host
+ *
+ *	\param	transport	the trace data transport
+ *	\return	true, if the transport has been set, false if the transport is
+ *		not supported, or if capture is active */
+bool swo_set_transport(enum SWO_TRANSPORT_ENUM transport)
+{
+	if (swo.is_active || transport > SWO_TRANSPORT_ENDPOINT)
+		return false;
+	swo.transport = transport;
+	return true;
+}
+
+/*!
+ *	\fn	bool swo_control(bool start)
+ *	\brief	starts, or stops trace capture
+ *
+ *	starting capture discards the data in the trace buffer, and clears
+ *	the error status; stopping capture leaves the data in the trace
+ *	buffer, so that it can still be read
+ *
+ *	\param	start	true to start capture, false to stop it
+ *	\return	true on success, false if capture cannot be started because
+ *		the capture mode, or the baudrate have not been set */
+bool swo_control(bool start)
+{
+	if (!start)
+	{
+		if (swo.is_active)
+			swo_phy_stop();
+		swo.is_active = false;
+		return true;
+	}
+	if (swo.mode != SWO_MODE_UART || !swo.baudrate)
+		return false;
+	if (swo.is_active)
+		return true;
+	swo.bytes_consumed = 0;
+	swo.is_overrun = false;
+	swo_phy_start();
+	swo.is_active = true;
+	return true;
+}
+
+/*!
+ *	\fn	int swo_get_status(void)
+ *	\brief	returns the trace capture status
+ *
+ *	\return	the trace status bits - see SWO_STATUS_ENUM */
+int swo_get_status(void)
+{
+int status = 0;
+
+	if (swo.is_active)
+		status |= SWO_STATUS_ACTIVE;
+	if (swo_phy_is_stream_error())
+		status |= SWO_STATUS_STREAM_ERROR;
+	if (swo.is_overrun || swo_phy_bytes_received() - swo.bytes_consumed > SWO_BUFFER_SIZE)
+		status |= SWO_STATUS_BUFFER_OVERRUN;
+	return status;
+}
+
+/*!
+ *	\fn	uint32_t swo_get_count(void)
+ *	\brief	returns the number of trace data bytes in the trace buffer
+ *
+ *	\return	the number of trace data bytes available for reading */
+uint32_t swo_get_count(void)
+{
+uint32_t count = swo_phy_bytes_received() - swo.bytes_consumed;
+
+	return (count > SWO_BUFFER_SIZE) ? 0 : count;
+}
+
+/*!
+ *	\fn	int swo_peek(const uint8_t ** data, int max_count)
+ *	\brief	locates the oldest trace data in the trace buffer, without consuming it
+ *
+ *	the trace data returned is contiguous in the trace buffer, so less
+ *	data than available may be returned when the data wraps around the
+ *	end of the buffer; the data must be consumed with swo_consume()
+ *	after it has been used
+ *
+ *	\param	data	a pointer to where to store the address of the trace data
+ *	\param	max_count	the maximum number of bytes to return
+ *	\return	the number of trace data bytes at '* data' */
+int swo_peek(const uint8_t ** data, int max_count)
+{
+uint32_t received = swo_phy_bytes_received(), offset, count;
+
+	if (received - swo.bytes_consumed > SWO_BUFFER_SIZE)
+	{
+		/* the phy has overwritten data that has not been consumed */
+		swo.is_overrun = true;
+		swo.bytes_consumed = received;
+	}
+	offset = swo.bytes_consumed & (SWO_BUFFER_SIZE - 1);
+	count = received - swo.bytes_consumed;
+	if (count > SWO_BUFFER_SIZE - offset)
+		count = SWO_BUFFER_SIZE - offset;
+	if (count > (uint32_t) max_count)
+		count = max_count;
+	* data = swo_buffer + offset;
+	return count;
+}
+
+/*!
+ *	\fn	void swo_consume(int count)
+ *	\brief	releases trace data located with swo_peek()
+ *
+ *	\param	count	the number of bytes to release */
+void swo_consume(int count)
+{
+	swo.bytes_consumed += count;
+}
+
+/*!
+ *	\fn	int swo_read(uint8_t * data, int max_count)
+ *	\brief	reads trace data from the trace buffer, for the DAP_SWO_Data command
+ *
+ *	trace data is only returned if the trace data transport has been set
+ *	to SWO_TRANSPORT_DAP_COMMAND
+ *
+ *	\param	data	a pointer to where to store the trace data
+ *	\param	max_count	the maximum number of bytes to read
+ *	\return	the number of bytes read */
+int swo_read(uint8_t * data, int max_count)
+{
+const uint8_t * p;
+int count, total = 0;
+
+	if (swo.transport != SWO_TRANSPORT_DAP_COMMAND)
+		return 0;
+	/* the data may wrap around the end of the trace buffer */
+	while (total < max_count && (count = swo_peek(& p, max_count - total)))
+	{
+		memcpy(data + total, p, count);
+		swo_consume(count);
+		total += count;
+	}
+	return total;
+}
+
+/*!
+ *	\fn	bool swo_is_streaming(void)
+ *	\brief	tells if trace data should be sent on the usb trace streaming endpoint
+ *
+ *	\return	true, if capture is active, and the trace data transport is
+ *		SWO_TRANSPORT_ENDPOINT */
+bool swo_is_streaming(void)
+{
+	return swo.is_active && swo.transport == SWO_TRANSPORT_ENDPOINT;
+}
@@ -0,0 +1,74 @@
+/*
+Copyright (c) 2015-2016 stoyan shopov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*! the serial wire output (swo) trace capture modes */
+enum SWO_MODE_ENUM
+{
+	/*! trace capture is off */
+	SWO_MODE_OFF		= 0,
+	/*! uart (nrz) encoded swo */
+	SWO_MODE_UART		= 1,
+	/*! manchester encoded swo - not supported */
+	SWO_MODE_MANCHESTER	= 2,
+};
+
+/*! the ways in which the captured trace data is transported to the host */
+enum SWO_TRANSPORT_ENUM
+{
+	/*! the trace data is not transported */
+	SWO_TRANSPORT_NONE	= 0,
+	/*! the trace data is read with cmsis-dap DAP_SWO_Data commands */
+	SWO_TRANSPORT_DAP_COMMAND	= 1,
+	/*! the trace data is streamed on a dedicated usb endpoint */
+	SWO_TRANSPORT_ENDPOINT	= 2,
+};
+
+/*! the trace status bits, as reported by the cmsis-dap DAP_SWO_Status and DAP_SWO_Data commands */
+enum SWO_STATUS_ENUM
+{
+	/*! trace capture is active */
+	SWO_STATUS_ACTIVE		= 1 << 0,
+	/*! a framing error has been detected on the swo line */
+	SWO_STATUS_STREAM_ERROR		= 1 << 6,
+	/*! trace data has been lost, because the trace buffer was full */
+	SWO_STATUS_BUFFER_OVERRUN	= 1 << 7,
+};
+
+enum
+{
+	/*! the size of the trace buffer, in bytes - must be a power of two */
+	SWO_BUFFER_SIZE		= 2048,
+};
+
+bool swo_set_mode(enum SWO_MODE_ENUM mode);
+uint32_t swo_set_baudrate(uint32_t baudrate);
+bool swo_set_transport(enum SWO_TRANSPORT_ENUM transport);
+bool swo_control(bool start);
+int swo_get_status(void);
+uint32_t swo_get_count(void);
+int swo_read(uint8_t * data, int max_count);
+int swo_peek(const uint8_t ** data, int max_count);
+void swo_consume(int count);
+bool swo_is_streaming(void);
@@ -1,18 +1,44 @@
 #include <libopencm3/cm3/scb.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/systick.h>
 
 #include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/st_usbfs.h>
 #include <libopencm3/usb/usbstd.h>
 #include <libopencm3/usb/usbd.h>
 #include <libopencm3/usb/hid.h>
 
+#include "cmsis-dap.h"
+#include "swd.h"
+#include "swo.h"
 
 enum
 {
 	USB_HID_IN_ENDPOINT_ADDRESS	= 0x81,
 	USB_HID_OUT_ENDPOINT_ADDRESS	= 0x1,
 	USB_HID_PACKET_SIZE		= 64,
-	USB_HID_POLLING_INTERVAL_MS	= 64,
+	USB_HID_POLLING_INTERVAL_MS	= 1,
 	USB_HID_INTERFACE_NUMBER	= 0,
+	/* the cmsis-dap v2 (bulk endpoint) interface */
+	USB_BULK_IN_ENDPOINT_ADDRESS	= 0x82,
+	USB_BULK_OUT_ENDPOINT_ADDRESS	= 0x2,
+	USB_BULK_PACKET_SIZE		= 64,
+	USB_BULK_INTERFACE_NUMBER	= 1,
+	/* the swo trace streaming endpoint of the bulk interface; with this
+	 * endpoint, the usb packet memory is fully used */
+	USB_SWO_IN_ENDPOINT_ADDRESS	= 0x83,
+	USB_SWO_PACKET_SIZE		= 64,
+	/* the string descriptor index of the bulk interface name; cmsis-dap v2
+	 * hosts look for the "CMSIS-DAP" substring in the interface name */
+	USB_BULK_INTERFACE_STRING_INDEX	= 3,
+	/* the vendor request code used by the host to retrieve
+	 * the microsoft os 2.0 descriptor set */
+	USB_MS_OS_20_VENDOR_CODE	= 0x01,
+	/* the wIndex value of the microsoft os 2.0 descriptor set vendor request */
+	USB_MS_OS_20_DESCRIPTOR_INDEX	= 7,
+	/* the binary device object store (bos) descriptor type */
+	USB_DT_BOS			= 15,
 };
 
 
@@ -22,7 +48,10 @@ static const struct usb_device_descriptor usb_device_descriptor =
 {
 	.bLength		=	USB_DT_DEVICE_SIZE,
 	.bDescriptorType	=	USB_DT_DEVICE,
-	.bcdUSB			=	0x200,
+	/* usb 2.1 - so that the host retrieves the bos descriptor,
+	 * needed for installing the winusb driver automatically for
+	 * the cmsis-dap v2 interface */
+	.bcdUSB			=	0x210,
 	.bDeviceClass		=	0,
 	.bDeviceSubClass	=	0,
 	.bDeviceProtocol	=	0,
@@ -122,12 +151,61 @@ static const struct usb_interface_descriptor hid_interface =
 };
 
 
+static const struct usb_endpoint_descriptor usb_bulk_endpoints[] =
+{
+	/* the cmsis-dap v2 specification mandates that the out endpoint comes first */
+	{
+		.bLength			=	USB_DT_ENDPOINT_SIZE,
+		.bDescriptorType		=	USB_DT_ENDPOINT,
+		.bEndpointAddress		=	USB_BULK_OUT_ENDPOINT_ADDRESS,
+		.bmAttributes			=	USB_ENDPOINT_ATTR_BULK,
+		.wMaxPacketSize			=	USB_BULK_PACKET_SIZE,
+		.bInterval			=	0,
+	},
+	{
+		.bLength			=	USB_DT_ENDPOINT_SIZE,
+		.bDescriptorType		=	USB_DT_ENDPOINT,
+		.bEndpointAddress		=	USB_BULK_IN_ENDPOINT_ADDRESS,
+		.bmAttributes			=	USB_ENDPOINT_ATTR_BULK,
+		.wMaxPacketSize			=	USB_BULK_PACKET_SIZE,
+		.bInterval			=	0,
+	},
+	/* the optional swo trace endpoint comes third */
+	{
+		.bLength			=	USB_DT_ENDPOINT_SIZE,
+		.bDescriptorType		=	USB_DT_ENDPOINT,
+		.bEndpointAddress		=	USB_SWO_IN_ENDPOINT_ADDRESS,
+		.bmAttributes			=	USB_ENDPOINT_ATTR_BULK,
+		.wMaxPacketSize			=	USB_SWO_PACKET_SIZE,
+		.bInterval			=	0,
+	},
+};
+
+static const struct usb_interface_descriptor bulk_interface =
+{
+	.bLength		=	USB_DT_INTERFACE_SIZE,
+	.bDescriptorType	=	USB_DT_INTERFACE,
+	.bInterfaceNumber	=	USB_BULK_INTERFACE_NUMBER,
+	.bAlternateSetting	=	0,
+	.bNumEndpoints		=	3,
+	.bInterfaceClass	=	USB_CLASS_VENDOR,
+	.bInterfaceSubClass	=	0,
+	.bInterfaceProtocol	=	0,
+	.iInterface		=	USB_BULK_INTERFACE_STRING_INDEX,
+	.endpoint		=	usb_bulk_endpoints,
+};
+
+
 static const struct usb_interface usb_interfaces[] =
 {
 	{
 		.num_altsetting	=	1,
 		.altsetting	=	& hid_interface,
 	},
+	{
+		.num_altsetting	=	1,
+		.altsetting	=	& bulk_interface,
+	},
 };
 
 static const struct usb_config_descriptor usb_config_descriptor =
@@ -139,7 +217,7 @@ static const struct usb_config_descriptor usb_config_descriptor =
 	 * to the host; it is not updated here, so this data structure can be
 	 * defined as 'const' */
 	/* .wTotalLength	= xxx*/
-	.bNumInterfaces		=	1,
+	.bNumInterfaces		=	2,
 	.bConfigurationValue	=	1,
 	.iConfiguration		=	0,
 	.bmAttributes		=	USB_CONFIG_ATTR_DEFAULT,
@@ -151,10 +229,150 @@ static const char * usb_strings[] =
 {
 	"shopov instruments",
 	"vx CMSIS-DAP debug probe",
+	"vx CMSIS-DAP v2 interface",
 };
 static uint8_t usb_control_buffer[128];
 
 
+/* the microsoft os 2.0 descriptor set - it instructs windows to bind
+ * the winusb driver to the cmsis-dap v2 interface, without the need
+ * for installing a driver .inf file; for details, refer to the
+ * "Microsoft OS 2.0 Descriptors Specification" document */
+static const struct __attribute__((packed))
+{
+	/* set header */
+	uint16_t	wLength;
+	uint16_t	wDescriptorType;
+	uint32_t	dwWindowsVersion;
+	uint16_t	wTotalLength;
+	/* configuration subset header */
+	struct __attribute__((packed))
+	{
+		uint16_t	wLength;
+		uint16_t	wDescriptorType;
+		uint8_t		bConfigurationValue;
+		uint8_t		bReserved;
+		uint16_t	wTotalLength;
+		/* function subset header */
+		struct __attribute__((packed))
+		{
+			uint16_t	wLength;
+			uint16_t	wDescriptorType;
+			uint8_t		bFirstInterface;
+			uint8_t		bReserved;
+			uint16_t	wSubsetLength;
+			/* compatible id descriptor */
+			struct __attribute__((packed))
+			{
+				uint16_t	wLength;
+				uint16_t	wDescriptorType;
+				uint8_t		CompatibleID[8];
+				uint8_t		SubCompatibleID[8];
+			}
+			compatible_id;
+			/* registry property descriptor */
+			struct __attribute__((packed))
+			{
+				uint16_t	wLength;
+				uint16_t	wDescriptorType;
+				uint16_t	wPropertyDataType;
+				uint16_t	wPropertyNameLength;
+				uint16_t	PropertyName[21];
+				uint16_t	wPropertyDataLength;
+				uint16_t	PropertyData[40];
+			}
+			registry_property;
+		}
+		function_subset;
+	}
+	configuration_subset;
+}
+usb_ms_os_20_descriptor_set =
+{
+	.wLength		=	10,
+	.wDescriptorType	=	0,	/* MS_OS_20_SET_HEADER_DESCRIPTOR */
+	.dwWindowsVersion	=	0x06030000,	/* windows 8.1 */
+	.wTotalLength		=	sizeof usb_ms_os_20_descriptor_set,
+	.configuration_subset =
+	{
+		.wLength		=	8,
+		.wDescriptorType	=	1,	/* MS_OS_20_SUBSET_HEADER_CONFIGURATION */
+		.bConfigurationValue	=	0,
+		.wTotalLength		=	sizeof usb_ms_os_20_descriptor_set.configuration_subset,
+		.function_subset =
+		{
+			.wLength		=	8,
+			.wDescriptorType	=	2,	/* MS_OS_20_SUBSET_HEADER_FUNCTION */
+			.bFirstInterface	=	USB_BULK_INTERFACE_NUMBER,
+			.wSubsetLength		=	sizeof usb_ms_os_20_descriptor_set.configuration_subset.function_subset,
+			.compatible_id =
+			{
+				.wLength		=	sizeof usb_ms_os_20_descriptor_set.configuration_subset.function_subset.compatible_id,
+				.wDescriptorType	=	3,	/* MS_OS_20_FEATURE_COMPATBLE_ID */
+				.CompatibleID		=	"WINUSB",
+			},
+			.registry_property =
+			{
+				.wLength		=	sizeof usb_ms_os_20_descriptor_set.configuration_subset.function_subset.registry_property,
+				.wDescriptorType	=	4,	/* MS_OS_20_FEATURE_REG_PROPERTY */
+				.wPropertyDataType	=	7,	/* REG_MULTI_SZ */
+				.wPropertyNameLength	=	sizeof usb_ms_os_20_descriptor_set.configuration_subset.function_subset.registry_property.PropertyName,
+				.PropertyName		=	u"DeviceInterfaceGUIDs",
+				.wPropertyDataLength	=	sizeof usb_ms_os_20_descriptor_set.configuration_subset.function_subset.registry_property.PropertyData,
+				/* this is the guid used by the arm cmsis-dap v2 reference
+				 * firmware; the property is a multi-string, and is therefore
+				 * terminated by two null characters */
+				.PropertyData		=	u"{CDB3B5AD-293B-4663-AA36-1AAE46463776}\0",
+			},
+		},
+	},
+};
+
+/* the binary device object store (bos) descriptor - it holds the
+ * microsoft os 2.0 platform capability descriptor */
+static const struct __attribute__((packed))
+{
+	uint8_t		bLength;
+	uint8_t		bDescriptorType;
+	uint16_t	wTotalLength;
+	uint8_t		bNumDeviceCaps;
+	/* microsoft os 2.0 platform capability descriptor */
+	struct __attribute__((packed))
+	{
+		uint8_t		bLength;
+		uint8_t		bDescriptorType;
+		uint8_t		bDevCapabilityType;
+		uint8_t		bReserved;
+		uint8_t		PlatformCapabilityUUID[16];
+		uint32_t	dwWindowsVersion;
+		uint16_t	wMSOSDescriptorSetTotalLength;
+		uint8_t		bMS_VendorCode;
+		uint8_t		bAltEnumCode;
+	}
+	ms_os_20_platform_capability;
+}
+usb_bos_descriptor =
+{
+	.bLength		=	5,
+	.bDescriptorType	=	USB_DT_BOS,
+	.wTotalLength		=	sizeof usb_bos_descriptor,
+	.bNumDeviceCaps		=	1,
+	.ms_os_20_platform_capability =
+	{
+		.bLength			=	sizeof usb_bos_descriptor.ms_os_20_platform_capability,
+		.bDescriptorType		=	0x10,	/* DEVICE CAPABILITY */
+		.bDevCapabilityType		=	0x05,	/* PLATFORM */
+		/* {D8DD60DF-4589-4CC7-9CD2-659D9E648A9F} */
+		.PlatformCapabilityUUID		=	{ 0xdf, 0x60, 0xdd, 0xd8, 0x89, 0x45, 0xc7, 0x4c,
+							0x9c, 0xd2, 0x65, 0x9d, 0x9e, 0x64, 0x8a, 0x9f, },
+		.dwWindowsVersion		=	0x06030000,	/* windows 8.1 */
+		.wMSOSDescriptorSetTotalLength	=	sizeof usb_ms_os_20_descriptor_set,
+		.bMS_VendorCode			=	USB_MS_OS_20_VENDOR_CODE,
+		.bAltEnumCode			=	0,
+	},
+};
+
+
 static int usbd_hid_control_callback(usbd_device *usbd_dev,
 		struct usb_setup_data *req, uint8_t **buf, uint16_t *len,
 		usbd_control_complete_callback *complete)
@@ -170,27 +388,407 @@ static int usbd_hid_control_callback(usbd_device *usbd_dev,
 	return USBD_REQ_HANDLED;
 }
 
-static void usbd_hid_set_config_callback(usbd_device * usbd_dev, uint16_t wValue)
+static int usbd_bos_control_callback(usbd_device *usbd_dev,
+		struct usb_setup_data *req, uint8_t **buf, uint16_t *len,
+		usbd_control_complete_callback *complete)
+{
+	if (req->bmRequestType != (USB_REQ_TYPE_IN | USB_REQ_TYPE_DEVICE)
+			|| req->bRequest != USB_REQ_GET_DESCRIPTOR
+			|| req->wValue != (USB_DT_BOS << 8))
+		return USBD_REQ_NEXT_CALLBACK;
+
+	buf[0] = (uint8_t *) & usb_bos_descriptor;
+	len[0] = (req->wLength < sizeof usb_bos_descriptor) ? req->wLength : sizeof usb_bos_descriptor;
+	return USBD_REQ_HANDLED;
+}
+
+static int usbd_ms_os_20_control_callback(usbd_device *usbd_dev,
+		struct usb_setup_data *req, uint8_t **buf, uint16_t *len,
+		usbd_control_complete_callback *complete)
+{
+	if (req->bmRequestType != (USB_REQ_TYPE_IN | USB_REQ_TYPE_VENDOR | USB_REQ_TYPE_DEVICE)
+			|| req->bRequest != USB_MS_OS_20_VENDOR_CODE
+			|| req->wIndex != USB_MS_OS_20_DESCRIPTOR_INDEX)
+		return USBD_REQ_NEXT_CALLBACK;
+
+	buf[0] = (uint8_t *) & usb_ms_os_20_descriptor_set;
+	len[0] = (req->wLength < sizeof usb_ms_os_20_descriptor_set) ? req->wLength : sizeof usb_ms_os_20_descriptor_set;
+	return USBD_REQ_HANDLED;
+}
+
+/* the bos and microsoft os 2.0 descriptors are requested by the host
+ * before the device gets configured, so these callbacks are registered
+ * both at startup, and when the device gets configured */
+static void usbd_register_control_callbacks(usbd_device * usbd_dev)
 {
-	usbd_ep_setup(usbd_dev, USB_HID_IN_ENDPOINT_ADDRESS, USB_ENDPOINT_ATTR_INTERRUPT, USB_HID_PACKET_SIZE, 0);
-	usbd_ep_setup(usbd_dev, USB_HID_OUT_ENDPOINT_ADDRESS, USB_ENDPOINT_ATTR_INTERRUPT, USB_HID_PACKET_SIZE, 0);
 	usbd_register_control_callback(usbd_dev,
 			USB_REQ_TYPE_STANDARD | USB_REQ_TYPE_INTERFACE,
 			USB_REQ_TYPE_TYPE | USB_REQ_TYPE_RECIPIENT,
 			usbd_hid_control_callback);
+	usbd_register_control_callback(usbd_dev,
+			USB_REQ_TYPE_STANDARD | USB_REQ_TYPE_DEVICE,
+			USB_REQ_TYPE_TYPE | USB_REQ_TYPE_RECIPIENT,
+			usbd_bos_control_callback);
+	usbd_register_control_callback(usbd_dev,
+			USB_REQ_TYPE_VENDOR | USB_REQ_TYPE_DEVICE,
+			USB_REQ_TYPE_TYPE | USB_REQ_TYPE_RECIPIENT,
+			usbd_ms_os_20_control_callback);
+}
+
+/* the cmsis-dap request and response packet queues
+ *
+ * requests are received in the usb interrupt handler, and are stored
+ * in the request queue; the main loop executes the queued requests and
+ * stores the responses in the response queue; responses are then shipped
+ * to the host from the usb interrupt handler, as soon as the in endpoint
+ * becomes available; requests are accepted on both the hid and the
+ * bulk interface out endpoints, and each response is sent on the in
+ * endpoint paired with the out endpoint its request came from - this
+ * way, receiving the next request, executing the current request on the
+ * serial wire bus, and transmitting the response to the previous request
+ * can all overlap
+ *
+ * cmsis-dap packets on the bulk interface can be larger than the bulk
+ * endpoint size (see CMSIS_DAP_PACKET_SIZE); such packets are transferred
+ * as several usb packets - a packet ends with a short (possibly zero
+ * length) usb packet, when CMSIS_DAP_PACKET_SIZE bytes have been
+ * transferred, or, for requests, as soon as the request length determined
+ * from the bytes received so far (see cmsis_dap_request_length()) has
+ * been received - hosts commonly do not send a zero length packet after
+ * a request that is a multiple of the usb packet size long; requests are
+ * reassembled directly in the request queue slots, and responses are
+ * shipped straight out of the response queue slots; while a request is
+ * being reassembled in the slot at the queue head, the packets received
+ * on the other out endpoint are left in the endpoint buffer, and are only
+ * read after the request has been completed
+ *
+ * the queue indices below are free running counters, the queue slot
+ * for a given index is the index value modulo the queue depth */
+static struct
+{
+	/* the packet buffers are word aligned, so that word sized fields
+	 * in the requests and responses can be accessed efficiently */
+	uint8_t		requests[CMSIS_DAP_PACKET_COUNT][CMSIS_DAP_PACKET_SIZE] __attribute__((aligned(4)));
+	uint8_t		responses[CMSIS_DAP_PACKET_COUNT][CMSIS_DAP_PACKET_SIZE] __attribute__((aligned(4)));
+	/* the out endpoint address on which each queued request was received; for
+	 * the slot at the queue head, this is the endpoint on which the request
+	 * being reassembled is received */
+	uint8_t		request_endpoints[CMSIS_DAP_PACKET_COUNT];
+	/* the in endpoint address on which to send each queued response */
+	uint8_t		response_endpoints[CMSIS_DAP_PACKET_COUNT];
+	/* the number of bytes to send for each queued response */
+	uint16_t	response_lengths[CMSIS_DAP_PACKET_COUNT];
+	/* the number of bytes of the request at the queue head received so far */
+	uint16_t	request_offset;
+	/* the number of bytes of the response at the queue tail submitted so far */
+	uint16_t	response_offset;
+	/* true, if the last usb packet of the response at the queue tail has been submitted */
+	bool		is_response_complete;
+	/* the request queue is filled by the usb interrupt handler, and drained by the main loop */
+	volatile uint32_t	request_head, request_tail;
+	/* the response queue is filled by the main loop, and drained by the usb interrupt handler */
+	volatile uint32_t	response_head, response_tail;
+	/* true, if a response packet is currently being transmitted to the host */
+	volatile bool		is_in_endpoint_busy;
+	/* true, if the out endpoints have been naked because the request queue is full */
+	volatile bool		is_out_endpoint_naked;
+	/* a bitmap of the out endpoints (by endpoint number) holding a received
+	 * usb packet that has not been read yet, because there was no free
+	 * request queue slot for it, or because a request from the other out
+	 * endpoint was being reassembled; such packets are left in the usb
+	 * packet memory, and the host is naked until they are read */
+	uint8_t			pending_out_endpoints;
+}
+dap_queue;
+
+static usbd_device * dap_usbd_dev;
+
+/*! \note	must be called either from the usb interrupt handler, or with interrupts disabled */
+static void dap_submit_response(void)
+{
+uint32_t slot = dap_queue.response_tail % CMSIS_DAP_PACKET_COUNT;
+uint16_t length;
+
+	if (dap_queue.is_in_endpoint_busy || dap_queue.response_tail == dap_queue.response_head)
+		return;
+	length = dap_queue.response_lengths[slot] - dap_queue.response_offset;
+	if (length > USB_BULK_PACKET_SIZE)
+		length = USB_BULK_PACKET_SIZE;
+	usbd_ep_write_packet(dap_usbd_dev, dap_queue.response_endpoints[slot],
+			dap_queue.responses[slot] + dap_queue.response_offset, length);
+	dap_queue.response_offset += length;
+	/* a short usb packet ends the response - otherwise, a zero length
+	 * packet must follow, unless the host buffer has been filled up */
+	dap_queue.is_response_complete = length < USB_BULK_PACKET_SIZE
+		|| dap_queue.response_offset == ((dap_queue.response_endpoints[slot] == USB_BULK_IN_ENDPOINT_ADDRESS)
+				? CMSIS_DAP_PACKET_SIZE : CMSIS_DAP_HID_PACKET_SIZE);
+	dap_queue.is_in_endpoint_busy = true;
+}
+
+/* the state of the swo trace streaming endpoint; trace data is sent
+ * straight out of the trace buffer */
+static struct
+{
+	/* true, if a trace data packet is currently being transmitted to the host */
+	volatile bool	is_in_endpoint_busy;
+	/* true, if the last packet sent was a full one - a zero length
+	 * packet is then sent when the trace data runs out, so that the
+	 * host does not wait for more data */
+	bool		is_zlp_needed;
+}
+swo_stream;
+
+/*! \note	must be called either from the usb interrupt handler, or with interrupts disabled */
+static void swo_submit_trace_data(void)
+{
+const uint8_t * data;
+int length;
+
+	if (swo_stream.is_in_endpoint_busy || !swo_is_streaming())
+		return;
+	length = swo_peek(& data, USB_SWO_PACKET_SIZE);
+	if (!length && !swo_stream.is_zlp_needed)
+		return;
+	usbd_ep_write_packet(dap_usbd_dev, USB_SWO_IN_ENDPOINT_ADDRESS, data, length);
+	swo_consume(length);
+	swo_stream.is_zlp_needed = (length == USB_SWO_PACKET_SIZE);
+	swo_stream.is_in_endpoint_busy = true;
+}
+
+/*! \note	must be called either from the usb interrupt handler, or with interrupts disabled */
+static void dap_set_out_endpoints_nak(bool nak)
+{
+	/* an endpoint holding a packet that has not been read yet must not
+	 * be re-enabled, or the packet would get overwritten */
+	if (nak || !(dap_queue.pending_out_endpoints & (1 << USB_HID_OUT_ENDPOINT_ADDRESS)))
+		usbd_ep_nak_set(dap_usbd_dev, USB_HID_OUT_ENDPOINT_ADDRESS, nak);
+	if (nak || !(dap_queue.pending_out_endpoints & (1 << USB_BULK_OUT_ENDPOINT_ADDRESS)))
+		usbd_ep_nak_set(dap_usbd_dev, USB_BULK_OUT_ENDPOINT_ADDRESS, nak);
+	dap_queue.is_out_endpoint_naked = nak;
+}
+
+static void dap_read_pending_out_packets(void);
+
+static void usbd_dap_out_callback(usbd_device * usbd_dev, uint8_t ep)
+{
+uint32_t head = dap_queue.request_head;
+uint16_t length;
+
+	if (head - dap_queue.request_tail == CMSIS_DAP_PACKET_COUNT
+			|| (dap_queue.request_offset && ep != dap_queue.request_endpoints[head % CMSIS_DAP_PACKET_COUNT]))
+	{
+		/* either the request queue is full - this packet has been
+		 * received on the other out endpoint before it got naked - or
+		 * a request from the other out endpoint is being reassembled in
+		 * the slot at the queue head; leave the packet in the endpoint
+		 * buffer (the endpoint stays naked until the packet is read),
+		 * and read it when the queue head slot becomes available; the
+		 * transfer complete flag is cleared here, as the packet is not
+		 * read now */
+		USB_CLR_EP_RX_CTR(ep);
+		dap_queue.pending_out_endpoints |= 1 << ep;
+		return;
+	}
+	if (head - dap_queue.request_tail == CMSIS_DAP_PACKET_COUNT - 1)
+		/* this packet may complete the request in the last free queue
+		 * slot - make the host wait until the main loop releases a slot;
+		 * this must be done before reading the packet, so that the
+		 * endpoint does not get re-enabled for reception */
+		dap_set_out_endpoints_nak(true);
+	dap_queue.request_endpoints[head % CMSIS_DAP_PACKET_COUNT] = ep;
+	length = usbd_ep_read_packet(usbd_dev, ep, dap_queue.requests[head % CMSIS_DAP_PACKET_COUNT] + dap_queue.request_offset,
+			USB_BULK_PACKET_SIZE);
+	dap_queue.request_offset += length;
+	if (!dap_queue.request_offset || (ep == USB_BULK_OUT_ENDPOINT_ADDRESS && length == USB_BULK_PACKET_SIZE
+				&& dap_queue.request_offset != CMSIS_DAP_PACKET_SIZE
+				&& !cmsis_dap_request_length(dap_queue.requests[head % CMSIS_DAP_PACKET_COUNT], dap_queue.request_offset)))
+	{
+		/* either a stray zero length packet, or more usb packets of
+		 * this request follow - the request is not queued yet */
+		if (dap_queue.is_out_endpoint_naked)
+			dap_set_out_endpoints_nak(false);
+		return;
+	}
+	dap_queue.request_offset = 0;
+	if (dap_queue.requests[head % CMSIS_DAP_PACKET_COUNT][0] == ID_DAP_TransferAbort)
+	{
+		/* transfer abort requests are not queued, and have no response -
+		 * they must take effect while a transfer is in progress */
+		sw_transfer_abort = true;
+		if (dap_queue.is_out_endpoint_naked)
+			dap_set_out_endpoints_nak(false);
+	}
+	else
+		dap_queue.request_head = head + 1;
+	dap_read_pending_out_packets();
+}
+
+/*!
+ *	\fn	static void dap_read_pending_out_packets(void)
+ *	\brief	reads the packets left in the out endpoint buffers
+ *
+ *	packets that still can not be read are left pending; the endpoints
+ *	whose packets have been read are re-enabled, unless the out endpoints
+ *	are naked because the request queue is full
+ *
+ *	\note	must be called either from the usb interrupt handler, or with interrupts disabled */
+static void dap_read_pending_out_packets(void)
+{
+uint8_t pending = dap_queue.pending_out_endpoints, ep;
+
+	dap_queue.pending_out_endpoints = 0;
+	for (ep = 0; pending; ep ++, pending >>= 1)
+		if (pending & 1)
+		{
+			usbd_dap_out_callback(dap_usbd_dev, ep);
+			/* the endpoint stays naked after reading the packet, if
+			 * it has been naked when the packet was received */
+			if (!dap_queue.is_out_endpoint_naked && !(dap_queue.pending_out_endpoints & (1 << ep)))
+				usbd_ep_nak_set(dap_usbd_dev, ep, false);
+		}
+}
+
+/*!
+ *	\fn	static void dap_release_request_slot(void)
+ *	\brief	releases the request queue slot at the queue tail, and resumes the reception of requests
+ *
+ *	the packets left in the out endpoint buffers while the request queue
+ *	was full are read first, and the out endpoints are re-enabled if there
+ *	is still a free request queue slot after that
+ *
+ *	\note	must be called with interrupts disabled */
+static void dap_release_request_slot(void)
+{
+	dap_queue.request_tail ++;
+	dap_read_pending_out_packets();
+	if (dap_queue.is_out_endpoint_naked && dap_queue.request_head - dap_queue.request_tail != CMSIS_DAP_PACKET_COUNT)
+		dap_set_out_endpoints_nak(false);
+}
+
+static void usbd_dap_in_callback(usbd_device * usbd_dev, uint8_t ep)
+{
+	if (dap_queue.is_response_complete)
+	{
+		dap_queue.response_tail ++;
+		dap_queue.response_offset = 0;
+	}
+	dap_queue.is_in_endpoint_busy = false;
+	dap_submit_response();
+}
+
+static void usbd_swo_in_callback(usbd_device * usbd_dev, uint8_t ep)
+{
+	swo_stream.is_in_endpoint_busy = false;
+	swo_submit_trace_data();
+}
+
+static void usbd_hid_set_config_callback(usbd_device * usbd_dev, uint16_t wValue)
+{
+	dap_queue.request_head = dap_queue.request_tail = 0;
+	dap_queue.response_head = dap_queue.response_tail = 0;
+	dap_queue.is_in_endpoint_busy = dap_queue.is_out_endpoint_naked = false;
+	dap_queue.request_offset = dap_queue.response_offset = 0;
+	dap_queue.pending_out_endpoints = 0;
+	swo_stream.is_in_endpoint_busy = swo_stream.is_zlp_needed = false;
+
+	usbd_ep_setup(usbd_dev, USB_HID_IN_ENDPOINT_ADDRESS, USB_ENDPOINT_ATTR_INTERRUPT, USB_HID_PACKET_SIZE, usbd_dap_in_callback);
+	usbd_ep_setup(usbd_dev, USB_HID_OUT_ENDPOINT_ADDRESS, USB_ENDPOINT_ATTR_INTERRUPT, USB_HID_PACKET_SIZE, usbd_dap_out_callback);
+	usbd_ep_setup(usbd_dev, USB_BULK_IN_ENDPOINT_ADDRESS, USB_ENDPOINT_ATTR_BULK, USB_BULK_PACKET_SIZE, usbd_dap_in_callback);
+	usbd_ep_setup(usbd_dev, USB_BULK_OUT_ENDPOINT_ADDRESS, USB_ENDPOINT_ATTR_BULK, USB_BULK_PACKET_SIZE, usbd_dap_out_callback);
+	usbd_ep_setup(usbd_dev, USB_SWO_IN_ENDPOINT_ADDRESS, USB_ENDPOINT_ATTR_BULK, USB_SWO_PACKET_SIZE, usbd_swo_in_callback);
+	usbd_register_control_callbacks(usbd_dev);
+}
+
+void usb_lp_can_rx0_isr(void)
+{
+	usbd_poll(dap_usbd_dev);
+}
+
+/*!
+ *	\fn	static void dap_process_requests(void)
+ *	\brief	executes the next queued cmsis-dap request, if there is one, and queues its response
+ *
+ *	a request is only executed when there is a free slot for its response
+ *	in the response queue; the request queue slot is released after the
+ *	request has been executed, and the out endpoint is re-enabled if it
+ *	has been naked because of a full request queue
+ *
+ *	ID_DAP_QueueCommands requests are held back until the host ends the
+ *	batch of queued requests by sending a request of another type (or until
+ *	the request queue fills up), and are then executed back-to-back */
+static void dap_process_requests(void)
+{
+uint32_t request_slot = dap_queue.request_tail % CMSIS_DAP_PACKET_COUNT;
+uint32_t response_slot = dap_queue.response_head % CMSIS_DAP_PACKET_COUNT;
+uint32_t head = dap_queue.request_head, i;
+int length;
+
+	if (dap_queue.request_tail == head)
+	{
+		/* no more requests to process - the serial wire bus is going
+		 * quiet; a transfer abort request received now has nothing
+		 * to abort, and is ignored - unless a new request has been
+		 * received meanwhile, which the abort request may refer to */
+		sw_bus_quiesce();
+		cm_disable_interrupts();
+		if (dap_queue.request_head == head)
+			sw_transfer_abort = false;
+		cm_enable_interrupts();
+		return;
+	}
+	if (dap_queue.response_head - dap_queue.response_tail == CMSIS_DAP_PACKET_COUNT)
+		return;
+	for (i = dap_queue.request_tail; i != head && dap_queue.requests[i % CMSIS_DAP_PACKET_COUNT][0] == ID_DAP_QueueCommands; i ++)
+		;
+	if (i == head && head - dap_queue.request_tail != CMSIS_DAP_PACKET_COUNT)
+		/* the batch of queued requests has not been completed yet */
+		return;
+	dap_queue.response_endpoints[response_slot] = dap_queue.request_endpoints[request_slot] | 0x80;
+	if (dap_queue.response_endpoints[response_slot] == USB_BULK_IN_ENDPOINT_ADDRESS)
+		length = cmsis_dap_process_request(dap_queue.requests[request_slot], dap_queue.responses[response_slot],
+				CMSIS_DAP_PACKET_SIZE);
+	else
+	{
+		cmsis_dap_process_request(dap_queue.requests[request_slot], dap_queue.responses[response_slot],
+				CMSIS_DAP_HID_PACKET_SIZE);
+		/* hid reports have a fixed size, so responses on the hid interface
+		 * are always sent as full packets - only the bulk interface ships
+		 * just the response bytes actually produced */
+		length = CMSIS_DAP_HID_PACKET_SIZE;
+	}
+	dap_queue.response_lengths[response_slot] = length;
+
+	cm_disable_interrupts();
+	dap_queue.response_head ++;
+	dap_release_request_slot();
+	dap_submit_response();
+	cm_enable_interrupts();
 }
 
 int main(void)
 {
-	usbd_device *usbd_dev;
+usbd_device *usbd_dev;
 	SCB_VTOR = 0x3000;
 	rcc_periph_clock_enable(RCC_GPIOA);
 	rcc_clock_setup_in_hse_8mhz_out_72mhz();
-	usbd_dev = usbd_init(& st_usbfs_v1_usb_driver, & usb_device_descriptor, & usb_config_descriptor,
+	/* the systick counter is left free running, for timing delays */
+	systick_set_clocksource(STK_CSR_CLKSOURCE_AHB);
+	systick_set_reload(0xffffff);
+	systick_counter_enable();
+	dap_usbd_dev = usbd_dev = usbd_init(& st_usbfs_v1_usb_driver, & usb_device_descriptor, & usb_config_descriptor,
 			usb_strings, sizeof usb_strings / sizeof * usb_strings,
 			usb_control_buffer, sizeof usb_control_buffer);
 	usbd_register_set_config_callback(usbd_dev, usbd_hid_set_config_callback);
+	usbd_register_control_callbacks(usbd_dev);
+	nvic_enable_irq(NVIC_USB_LP_CAN_RX0_IRQ);
 	while (1)
-		usbd_poll(usbd_dev);
+	{
+		dap_process_requests();
+		/* trace data streaming is kept going by the usb interrupt
+		 * handler while the endpoint is busy, and is restarted
+		 * here when new trace data arrives */
+		cm_disable_interrupts();
+		swo_submit_trace_data();
+		cm_enable_interrupts();
+	}
 }
-